@@ -0,0 +1,8 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    app \
+    bench
+
+app.file = src/Labeling.pro
+bench.file = bench/bench.pro
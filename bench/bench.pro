@@ -0,0 +1,18 @@
+QT += core gui widgets svg concurrent
+
+TARGET = bench
+TEMPLATE = app
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+include(../src/sources.pri)
+
+HEADERS += \
+    benchmark.h
+
+SOURCES += \
+    benchmark.cpp \
+    main.cpp
@@ -0,0 +1,329 @@
+#include "benchmark.h"
+#include "renderarea.h"
+#include "labelfile.h"
+#include "volume.h"
+#include "slicecache.h"
+#include "tiledecoder.h"
+#include <algorithm>
+#include <cstdio>
+
+int Benchmark::run(int argc, char** argv) {
+    QApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measure the hot paths on synthetic data.");
+    parser.addHelpOption();
+    QCommandLineOption quickOption("quick", "Only run the smallest scale of each case.");
+    QCommandLineOption outputOption("output", "Write results to <file> instead of the standard output.", "file");
+    parser.addOptions({quickOption, outputOption});
+    parser.process(app);
+
+    // Keep volume caches out of the user's cache folder
+    QStandardPaths::setTestModeEnabled(true);
+
+    Benchmark bench;
+    if (!bench.dir.isValid()) {
+        fprintf(stderr, "Cannot create a temporary folder\n");
+        return 1;
+    }
+    bool quick = parser.isSet(quickOption);
+    for (int count: {1000, 10000, 50000}) {
+        bench.benchCanvas(count);
+        bench.benchLabelFile(count);
+        bench.benchMagnifier(count);
+        if (quick)
+            break;
+    }
+    bench.benchStroke(Label::Region);
+    bench.benchStroke(Label::Mask);
+    for (int size: {64, 256}) {
+        bench.benchVolume(size);
+        if (quick)
+            break;
+    }
+    bench.benchTiles();
+
+    QByteArray json = QJsonDocument(bench.toJson()).toJson();
+    if (!parser.isSet(outputOption)) {
+        fwrite(json.constData(), 1, json.size(), stdout);
+        return 0;
+    }
+    QSaveFile file(parser.value(outputOption));
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) < 0 || !file.commit()) {
+        fprintf(stderr, "Cannot write %s\n", qPrintable(QDir::toNativeSeparators(file.fileName())));
+        return 1;
+    }
+    return 0;
+}
+
+void Benchmark::measure(const QString& name, int scale, const std::function<void()>& func) {
+    // The first run fills caches and is not counted
+    func();
+    QVector<qint64> times;
+    QElapsedTimer total;
+    total.start();
+    while (times.size() < 3 || (total.elapsed() < MinTime && times.size() < MaxIterations)) {
+        QElapsedTimer timer;
+        timer.start();
+        func();
+        times << timer.nsecsElapsed();
+    }
+    std::sort(times.begin(), times.end());
+    results << Result{name, scale, times.size(), times[times.size()/2], times.first()};
+    fprintf(stderr, "%-24s %8d %12.3f ms\n", qPrintable(name), scale, times[times.size()/2]/1e6);
+}
+
+QList<Label> Benchmark::randomLabels(int count, const QSize& size, quint32 seed) {
+    QRandomGenerator random(seed);
+    QList<Label> labels;
+    labels.reserve(count);
+    for (int n = 0; n < count; ++n) {
+        QColor color(random.bounded(256), random.bounded(256), random.bounded(256));
+        QPointF center(random.bounded(size.width()), random.bounded(size.height()));
+        qreal radius = 8 + random.bounded(56);
+        QPainterPath path;
+        int shape = random.bounded(2) ? Label::Rect : Label::Poly;
+        if (shape == Label::Rect) {
+            path.addRect(QRectF(center - QPointF(radius, radius), QSizeF(radius*2, radius*2)));
+        } else {
+            for (int i = 0; i < 6; ++i) {
+                QPointF pt = center + radius*QPointF(qCos(i*M_PI/3), qSin(i*M_PI/3));
+                if (i)
+                    path.lineTo(pt);
+                else
+                    path.moveTo(pt);
+            }
+            path.closeSubpath();
+        }
+        color.setAlpha(0x40);
+        labels << Label{QString("tag%1").arg(n % 16), shape, Label::getPen(color), QBrush(color), path};
+    }
+    return labels;
+}
+
+void Benchmark::benchCanvas(int count) {
+    RenderArea canvas;
+    QImage img(ImageSize, ImageSize, QImage::Format_RGB32);
+    img.fill(Qt::gray);
+    canvas.setImage(img);
+    QList<Label> labels = randomLabels(count, img.size(), 1);
+    canvas.setLabelList(labels);
+
+    // A typical viewport
+    QRect view(0, 0, 1920, 1080);
+    QImage target(view.size(), QImage::Format_ARGB32_Premultiplied);
+    measure("paint_cached", count, [&] () {
+        canvas.render(&target, QPoint(), QRegion(view));
+    });
+    measure("paint_after_change", count, [&] () {
+        canvas.setLabelList(labels);
+        canvas.render(&target, QPoint(), QRegion(view));
+    });
+
+    QRandomGenerator random(2);
+    measure("hit_test", count, [&] () {
+        QPointF pos(random.bounded(ImageSize), random.bounded(ImageSize));
+        QMouseEvent event(QEvent::MouseButtonPress, pos, Qt::LeftButton, Qt::LeftButton, Qt::NoModifier);
+        QCoreApplication::sendEvent(&canvas, &event);
+    });
+}
+
+void Benchmark::benchStroke(int shape) {
+    RenderArea canvas;
+    QImage img(ImageSize, ImageSize, QImage::Format_RGB32);
+    img.fill(Qt::gray);
+    canvas.setImage(img);
+    QColor color(Qt::red);
+    color.setAlpha(0x40);
+    Label label{"stroke", shape, Label::getPen(color), QBrush(color), QPainterPath()};
+
+    // A zigzag stroke of steps moves
+    const int steps = 200;
+    measure(shape == Label::Mask ? "mask_stroke" : "region_stroke", steps, [&] () {
+        canvas.setLabelList({});
+        canvas.newLabel(label);
+        QPointF pos(100, 100);
+        QMouseEvent press(QEvent::MouseButtonPress, pos, Qt::LeftButton, Qt::LeftButton, Qt::NoModifier);
+        QCoreApplication::sendEvent(&canvas, &press);
+        for (int i = 1; i <= steps; ++i) {
+            pos = QPointF(100 + i*8, 100 + (i % 20)*16);
+            QMouseEvent move(QEvent::MouseMove, pos, Qt::NoButton, Qt::LeftButton, Qt::NoModifier);
+            QCoreApplication::sendEvent(&canvas, &move);
+        }
+        QMouseEvent finish(QEvent::MouseButtonPress, pos, Qt::RightButton, Qt::RightButton, Qt::NoModifier);
+        QCoreApplication::sendEvent(&canvas, &finish);
+    });
+}
+
+void Benchmark::benchLabelFile(int count) {
+    QList<Label> labels = randomLabels(count, QSize(ImageSize, ImageSize), 3);
+    QString compact = dir.filePath("compact.dat");
+    QString legacy = dir.filePath("legacy.dat");
+    measure("save_compact", count, [&] () {
+        LabelFile::write(compact, labels);
+    });
+    measure("save_legacy", count, [&] () {
+        LabelFile::write(legacy, labels, LabelFile::Legacy);
+    });
+    QList<Label> loaded;
+    measure("load_compact", count, [&] () {
+        LabelFile::read(compact, &loaded);
+    });
+    measure("load_legacy", count, [&] () {
+        LabelFile::read(legacy, &loaded);
+    });
+}
+
+void Benchmark::benchVolume(int size) {
+    // Slices of a sphere so that the contents vary along every axis
+    QDir slices(dir.filePath(QString("volume%1").arg(size)));
+    slices.mkpath(".");
+    QImage slice(size, size, QImage::Format_Grayscale8);
+    for (int k = 0; k < size; ++k) {
+        for (int i = 0; i < size; ++i) {
+            uchar* line = slice.scanLine(i);
+            for (int j = 0; j < size; ++j) {
+                int dx = j - size/2, dy = i - size/2, dz = k - size/2;
+                line[j] = uchar(qMax(0, 255 - qRound(qSqrt(dx*dx + dy*dy + dz*dz)*512/size)));
+            }
+        }
+        slice.save(slices.filePath(QString("%1.png").arg(k, 4, 10, QChar('0'))));
+    }
+
+    Volume volume;
+    QString error;
+    QElapsedTimer timer;
+    timer.start();
+    if (!volume.load(slices.path(), &error)) {
+        fprintf(stderr, "Cannot load the synthetic volume: %s\n", qPrintable(error));
+        return;
+    }
+    results << Result{"volume_build", size, 1, timer.nsecsElapsed(), timer.nsecsElapsed()};
+
+    QImage img;
+    QRandomGenerator random(4);
+    measure("volume_top", size, [&] () {
+        volume.top(random.bounded(size), &img);
+    });
+    measure("volume_left", size, [&] () {
+        volume.left(random.bounded(size), &img);
+    });
+    measure("volume_front", size, [&] () {
+        volume.front(random.bounded(size), &img);
+    });
+
+    // Show the slices through a cursor as the 3D window does
+    SliceCache cache(&volume);
+    auto show = [&] (int x, int y, int z) {
+        cache.get(SliceCache::Top, z);
+        cache.prefetch(SliceCache::Top, z);
+        cache.get(SliceCache::Left, x);
+        cache.prefetch(SliceCache::Left, x);
+        cache.get(SliceCache::Front, y);
+        cache.prefetch(SliceCache::Front, y);
+    };
+
+    // Scrub back and forth over a short range as a user would
+    int position = 0;
+    measure("subwindow_scrub", size, [&] () {
+        int k = qAbs(position++ % 32 - 16);
+        show(k, k, k);
+    });
+    measure("subwindow_jump", size, [&] () {
+        show(random.bounded(size), random.bounded(size), random.bounded(size));
+    });
+
+    // Each run builds a new cache since the slices have new times
+    cache.clear();
+    QString cacheName = volume.fileName();
+    volume.close();
+    QFile::remove(cacheName);
+}
+
+void Benchmark::benchTiles() {
+    // A JPEG large enough to be decoded by tiles, with detail so that it doesn't compress to nothing
+    int size = ImageSize*2;
+    QString fileName = dir.filePath("large.jpg");
+    {
+        QImage img(size, size, QImage::Format_RGB32);
+        for (int y = 0; y < size; ++y) {
+            QRgb* line = reinterpret_cast<QRgb*>(img.scanLine(y));
+            for (int x = 0; x < size; ++x)
+                line[x] = qRgb(x ^ y, x*3 + y, (x + y*5) >> 2);
+        }
+        img.save(fileName, "JPEG", 90);
+    }
+
+    // Wait in an event loop until the decoded images arrive
+    auto waitFor = [] (TileDecoder& decoder, const std::function<bool()>& ready) {
+        QEventLoop loop;
+        QObject::connect(&decoder, &TileDecoder::tileReady, &loop, [&] () {
+            if (ready())
+                loop.quit();
+        });
+        QObject::connect(&decoder, &TileDecoder::failed, &loop, &QEventLoop::quit);
+        if (!ready())
+            loop.exec();
+    };
+
+    // Time to first pixel is the time to the preview
+    measure("tiles_first_pixel", size, [&] () {
+        TileDecoder decoder;
+        decoder.preview(fileName);
+        waitFor(decoder, [&] () {
+            return !decoder.preview(fileName).isNull();
+        });
+    });
+
+    // A 1920x1080 viewport at the bottom of the image at full size, the worst case for JPEG
+    int bottom = (size - 1)/TileDecoder::TileSize;
+    int top = (size - 1080)/TileDecoder::TileSize;
+    int right = (1920 - 1)/TileDecoder::TileSize;
+    measure("tiles_viewport", size, [&] () {
+        TileDecoder decoder;
+        decoder.request(fileName, 0, top, bottom);
+        waitFor(decoder, [&] () {
+            for (int y = top; y <= bottom; ++y)
+                for (int x = 0; x <= right; ++x)
+                    if (decoder.tile(fileName, 0, x, y).isNull())
+                        return false;
+            return true;
+        });
+    });
+}
+
+void Benchmark::benchMagnifier(int count) {
+    RenderArea canvas;
+    QImage img(ImageSize, ImageSize, QImage::Format_RGB32);
+    img.fill(Qt::gray);
+    canvas.setImage(img);
+    canvas.setLabelList(randomLabels(count, img.size(), 5));
+
+    // The magnifier of the smallest size shows 100x100 pixels around the cursor
+    QSize size(100, 100);
+    QImage source;
+    QRandomGenerator random(6);
+    measure("magnifier", count, [&] () {
+        QPoint topLeft(random.bounded(ImageSize - size.width()), random.bounded(ImageSize - size.height()));
+        canvas.composite(QRect(topLeft, size), &source);
+    });
+}
+
+QJsonObject Benchmark::toJson() const {
+    QJsonArray array;
+    for (const Result& result: results)
+        array.append(QJsonObject{
+            {"name", result.name},
+            {"scale", result.scale},
+            {"iterations", result.iterations},
+            {"median_ns", double(result.median)},
+            {"min_ns", double(result.minimum)}
+        });
+    return QJsonObject{
+        {"qt", qVersion()},
+        {"cpu", QSysInfo::currentCpuArchitecture()},
+        {"os", QSysInfo::prettyProductName()},
+        {"threads", QThread::idealThreadCount()},
+        {"label_bytes", int(sizeof(Label))},
+        {"results", array}
+    };
+}
@@ -0,0 +1,55 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QtWidgets>
+#include "label.h"
+
+// Measure the hot paths of the application on synthetic data
+//
+//   bench [--quick] [--output <file>]
+//
+// Each case runs until it has taken some time, and the median and minimum times are reported as JSON
+// so that results can be compared across releases.
+// Fixtures are generated from fixed seeds, so every run measures the same data.
+// Set QT_QPA_PLATFORM=offscreen to run without a display.
+
+class Benchmark {
+public:
+    struct Result {
+        QString name;
+        int scale;
+        int iterations;
+        qint64 median;
+        qint64 minimum;
+    };
+
+public:
+    static int run(int argc, char** argv);
+
+private:
+    // Run a case repeatedly for at least MinTime ms, times in nanoseconds
+    void measure(const QString& name, int scale, const std::function<void()>& func);
+
+    static QList<Label> randomLabels(int count, const QSize& size, quint32 seed);
+
+    void benchCanvas(int count);
+    void benchStroke(int shape);
+    void benchLabelFile(int count);
+    void benchVolume(int size);
+    void benchTiles();
+    void benchMagnifier(int count);
+
+    QJsonObject toJson() const;
+
+    static const int MinTime = 200;
+    static const int MaxIterations = 1000;
+
+    // Size of the synthetic image
+    static const int ImageSize = 4096;
+
+private:
+    QList<Result> results;
+    QTemporaryDir dir;
+};
+
+#endif // BENCHMARK_H
@@ -1,7 +1,12 @@
 #include "mainwindow.h"
+#include "batch.h"
 #include <QApplication>
 
 int main(int argc, char** argv) {
+    // No window or display is needed to convert files
+    if (Batch::isRequested(argc, argv))
+        return Batch::run(argc, argv);
+
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
@@ -0,0 +1,83 @@
+# Sources shared by the application and the benchmark
+
+# Scoped timers for interactive latency, removed with CONFIG+=notrace
+!notrace {
+    DEFINES += LABELING_TRACE
+
+    HEADERS += \
+        $$PWD/utils/trace.h \
+        $$PWD/widgets/traceoverlay.h
+
+    SOURCES += \
+        $$PWD/utils/trace.cpp \
+        $$PWD/widgets/traceoverlay.cpp
+}
+
+INCLUDEPATH += \
+    $$PWD/dialogs \
+    $$PWD/utils \
+    $$PWD/widgets \
+    $$PWD/windows
+
+HEADERS += \
+    $$PWD/dialogs/cuboiddialog.h \
+    $$PWD/dialogs/labeldialog.h \
+    $$PWD/utils/autosaver.h \
+    $$PWD/utils/batch.h \
+    $$PWD/utils/cuboidindex.h \
+    $$PWD/utils/datasetindex.h \
+    $$PWD/utils/folderscanner.h \
+    $$PWD/utils/imagecache.h \
+    $$PWD/utils/imagepyramid.h \
+    $$PWD/utils/labelfile.h \
+    $$PWD/utils/labelgrid.h \
+    $$PWD/utils/listex.h \
+    $$PWD/utils/maskrasterizer.h \
+    $$PWD/utils/slicecache.h \
+    $$PWD/utils/slotmap.h \
+    $$PWD/utils/styletable.h \
+    $$PWD/utils/tiledecoder.h \
+    $$PWD/utils/undostack.h \
+    $$PWD/utils/util.h \
+    $$PWD/utils/volume.h \
+    $$PWD/widgets/cuboidlabel.h \
+    $$PWD/widgets/label.h \
+    $$PWD/widgets/regionmask.h \
+    $$PWD/widgets/renderarea.h \
+    $$PWD/windows/mainwindow.h \
+    $$PWD/windows/subwindow.h \
+    $$PWD/windows/windowfwd.h
+
+SOURCES += \
+    $$PWD/dialogs/cuboiddialog.cpp \
+    $$PWD/dialogs/labeldialog.cpp \
+    $$PWD/utils/autosaver.cpp \
+    $$PWD/utils/batch.cpp \
+    $$PWD/utils/cuboidindex.cpp \
+    $$PWD/utils/datasetindex.cpp \
+    $$PWD/utils/folderscanner.cpp \
+    $$PWD/utils/imagecache.cpp \
+    $$PWD/utils/imagepyramid.cpp \
+    $$PWD/utils/labelfile.cpp \
+    $$PWD/utils/labelgrid.cpp \
+    $$PWD/utils/maskrasterizer.cpp \
+    $$PWD/utils/slicecache.cpp \
+    $$PWD/utils/styletable.cpp \
+    $$PWD/utils/tiledecoder.cpp \
+    $$PWD/utils/undostack.cpp \
+    $$PWD/utils/volume.cpp \
+    $$PWD/widgets/cuboidlabel.cpp \
+    $$PWD/widgets/label.cpp \
+    $$PWD/widgets/regionmask.cpp \
+    $$PWD/widgets/renderarea.cpp \
+    $$PWD/windows/mainwindow.cpp \
+    $$PWD/windows/subwindow.cpp
+
+FORMS += \
+    $$PWD/dialogs/cuboiddialog.ui \
+    $$PWD/dialogs/labeldialog.ui \
+    $$PWD/windows/mainwindow.ui \
+    $$PWD/windows/subwindow.ui
+
+RESOURCES += \
+    $$PWD/icons.qrc
@@ -0,0 +1,255 @@
+#include "autosaver.h"
+#include "labelfile.h"
+#include "undostack.h"
+#include <cstring>
+
+const char AutoSaver::Magic[4] = {'L', 'B', 'L', 'J'};
+const int AutoSaver::Version;
+const int AutoSaver::MaxRecords;
+const qint64 AutoSaver::MaxJournalSize;
+
+AutoSaver::AutoSaver(QObject* parent) :
+    QObject(parent)
+{
+    // Jobs must run in the order they are queued
+    pool.setMaxThreadCount(1);
+    timer.setSingleShot(true);
+    timer.setInterval(3000);
+    connect(&timer, &QTimer::timeout, this, &AutoSaver::flush);
+}
+
+AutoSaver::~AutoSaver() {
+    close();
+    pool.waitForDone();
+}
+
+void AutoSaver::open(const QString& fileName, const QList<Label>& labels) {
+    close();
+    this->fileName = fileName;
+    this->labels = labels;
+    schedule(fileName, [=] () {
+        begin(fileName, labels);
+    });
+}
+
+void AutoSaver::close() {
+    if (fileName.isEmpty())
+        return;
+    // Edits journaled before auto saving was disabled are still compacted
+    if (enabled)
+        flush();
+    schedule(fileName, [=] () {
+        compact(base);
+    });
+    timer.stop();
+    fileName.clear();
+    labels.clear();
+    dirty = false;
+}
+
+void AutoSaver::record(const QList<Label>& labels) {
+    if (fileName.isEmpty())
+        return;
+    // Copying the list is cheap since labels are shared until modified
+    this->labels = labels;
+    dirty = true;
+    // Keep the interval from the first edit so that continuous editing is still saved
+    if (enabled && !paused.contains(fileName) && !timer.isActive())
+        timer.start();
+}
+
+void AutoSaver::save(const QList<Label>& labels) {
+    if (fileName.isEmpty())
+        return;
+    saveAs(fileName, labels, LabelFile::Compact);
+}
+
+void AutoSaver::saveAs(const QString& fileName, const QList<Label>& labels, int format) {
+    if (fileName == this->fileName) {
+        timer.stop();
+        this->labels = labels;
+        dirty = false;
+    }
+    schedule(fileName, [=] () {
+        write(fileName, labels, format);
+    });
+}
+
+void AutoSaver::setEnabled(bool enabled) {
+    this->enabled = enabled;
+    if (!enabled)
+        timer.stop();
+    else if (dirty && !paused.contains(fileName))
+        timer.start();
+}
+
+bool AutoSaver::isEnabled() const {
+    return enabled;
+}
+
+void AutoSaver::setInterval(int msec) {
+    timer.setInterval(msec);
+}
+
+bool AutoSaver::wait(const QString& fileName) {
+    if (!writes.contains(fileName))
+        return false;
+    writes.take(fileName).waitForFinished();
+    return true;
+}
+
+bool AutoSaver::recover(const QString& fileName, QList<Label>* labels) {
+    QFile journal(journalName(fileName));
+    if (!journal.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&journal);
+    char magic[4];
+    qint32 version;
+    QByteArray digest;
+    if (in.readRawData(magic, 4) != 4 || memcmp(magic, Magic, 4) != 0)
+        return false;
+    in >> version >> digest;
+    // A journal written against another label file is left from a finished compaction
+    if (in.status() != QDataStream::Ok || version != Version || digest != hash(fileName))
+        return false;
+    bool applied = false;
+    for (;;) {
+        // Each record is written as a whole so a torn one fails to read
+        QByteArray record;
+        in >> record;
+        if (in.status() != QDataStream::Ok)
+            break;
+        QDataStream recordIn(record);
+        qint32 index, removed;
+        QList<Label> inserted;
+        recordIn >> index >> removed >> inserted;
+        if (recordIn.status() != QDataStream::Ok || index < 0 || removed < 0 || index + removed > labels->size())
+            break;
+        *labels = labels->mid(0, index) + inserted + labels->mid(index + removed);
+        applied = true;
+    }
+    return applied;
+}
+
+QString AutoSaver::journalName(const QString& fileName) {
+    return fileName + ".journal";
+}
+
+void AutoSaver::flush() {
+    timer.stop();
+    // Edits are kept until an explicit save
+    if (!dirty || paused.contains(fileName))
+        return;
+    dirty = false;
+    QList<Label> labels = this->labels;
+    schedule(fileName, [=] () {
+        append(labels);
+    });
+}
+
+void AutoSaver::schedule(const QString& fileName, const std::function<void()>& job) {
+    for (auto it = writes.begin(); it != writes.end();) {
+        if (it->isFinished())
+            it = writes.erase(it);
+        else
+            ++it;
+    }
+    writes.insert(fileName, QtConcurrent::run(&pool, job));
+}
+
+void AutoSaver::begin(const QString& fileName, const QList<Label>& labels) {
+    file = fileName;
+    base = labels;
+    records = 0;
+    journalSize = 0;
+    // The labels already include a journal left by a crash
+    if (QFile::exists(journalName(file)))
+        compact(base, true);
+}
+
+void AutoSaver::append(const QList<Label>& labels) {
+    UndoStack::Edit edit = UndoStack::diff(base, labels);
+    if (edit.removed.empty() && edit.inserted.empty())
+        return;
+    QFile journal(journalName(file));
+    if (!journal.open(records == 0 ? QIODevice::WriteOnly | QIODevice::Truncate : QIODevice::Append)) {
+        finish(file, false, false);
+        return;
+    }
+    QDataStream out(&journal);
+    if (records == 0) {
+        out.writeRawData(Magic, 4);
+        out << qint32(Version) << hash(file);
+    }
+    QByteArray record;
+    QDataStream recordOut(&record, QIODevice::WriteOnly);
+    recordOut << qint32(edit.index) << qint32(edit.removed.size()) << edit.inserted;
+    out << record;
+    if (!journal.flush() || out.status() != QDataStream::Ok) {
+        finish(file, false, false);
+        return;
+    }
+    base = labels;
+    ++records;
+    journalSize = journal.size();
+    if (records >= MaxRecords || journalSize >= MaxJournalSize)
+        compact(base);
+}
+
+void AutoSaver::compact(const QList<Label>& labels, bool force) {
+    if (records == 0 && !force)
+        return;
+    // The label file is written to a temporary file and renamed over the old one
+    if (!LabelFile::write(file, labels)) {
+        finish(file, false, false);
+        return;
+    }
+    // The journal no longer matches the label file even if this fails
+    QFile::remove(journalName(file));
+    base = labels;
+    records = 0;
+    journalSize = 0;
+    finish(file, true, false);
+}
+
+void AutoSaver::write(const QString& fileName, const QList<Label>& labels, int format) {
+    bool ok = LabelFile::write(fileName, labels, format);
+    // The label file of the current image now holds the labels in the chosen format
+    if (ok && fileName == file) {
+        QFile::remove(journalName(file));
+        base = labels;
+        records = 0;
+        journalSize = 0;
+    }
+    finish(fileName, ok, true);
+}
+
+void AutoSaver::finish(const QString& fileName, bool ok, bool requested) {
+    QMetaObject::invokeMethod(this, [=] () {
+        if (ok) {
+            if (requested)
+                paused.remove(fileName);
+            emit saved(fileName);
+            return;
+        }
+        if (requested) {
+            emit failed(fileName, paused.contains(fileName));
+            return;
+        }
+        if (paused.contains(fileName))
+            return;
+        // Pause before reporting so that no timer fires again under a message box
+        paused.insert(fileName);
+        if (fileName == this->fileName)
+            timer.stop();
+        emit failed(fileName, true);
+    }, Qt::QueuedConnection);
+}
+
+QByteArray AutoSaver::hash(const QString& fileName) {
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    QFile file(fileName);
+    if (file.open(QIODevice::ReadOnly))
+        hash.addData(&file);
+    return hash.result();
+}
@@ -0,0 +1,105 @@
+#ifndef AUTOSAVER_H
+#define AUTOSAVER_H
+
+#include <QtGui>
+#include <QtConcurrent>
+#include "label.h"
+
+// Save the labels of the current image in the background
+// Edits are appended to a journal next to the label file every few seconds,
+// and the journal is compacted into the label file, which is replaced by a rename.
+// A journal left by a crash is applied when the labels are read again.
+// All file work runs in order on a single worker thread.
+// After an automatic write fails, a file is no longer saved automatically until it's saved explicitly.
+
+class AutoSaver : public QObject {
+    Q_OBJECT
+
+public:
+    explicit AutoSaver(QObject* parent = nullptr);
+    ~AutoSaver();
+
+    // Start saving a label file with its current labels, closing the previous one
+    void open(const QString& fileName, const QList<Label>& labels);
+
+    // Write the pending edits of the current file if enabled and stop saving it
+    void close();
+
+    // Record the labels after an edit, they are journaled within the interval
+    void record(const QList<Label>& labels);
+
+    // Write the labels to the label file now even if disabled
+    void save(const QList<Label>& labels);
+
+    // Write the labels to any file in the queue, so that it's ordered with the writes to the same file
+    void saveAs(const QString& fileName, const QList<Label>& labels, int format);
+
+    // Without auto saving, edits are only written by save
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+
+    void setInterval(int msec);
+
+    // Wait until queued writes to a file finish, return whether there were any
+    bool wait(const QString& fileName);
+
+    // Apply the journal of a label file if it was written against the current file
+    static bool recover(const QString& fileName, QList<Label>* labels);
+
+    static QString journalName(const QString& fileName);
+
+signals:
+    // Emitted after a file is replaced
+    void saved(const QString& fileName);
+
+    // Emitted for every failed explicit save but only once for automatic ones, which are then paused
+    void failed(const QString& fileName, bool paused);
+
+private:
+    // Journal the labels recorded since the last flush
+    void flush();
+
+    void schedule(const QString& fileName, const std::function<void()>& job);
+
+    // Only called by jobs on the worker thread
+    void begin(const QString& fileName, const QList<Label>& labels);
+    void append(const QList<Label>& labels);
+    void compact(const QList<Label>& labels, bool force = false);
+    void write(const QString& fileName, const QList<Label>& labels, int format);
+
+    // Report the result of a write to the GUI thread
+    void finish(const QString& fileName, bool ok, bool requested);
+
+    static QByteArray hash(const QString& fileName);
+
+    static const char Magic[4];
+    static const int Version = 1;
+
+    // The journal is compacted when it grows beyond either
+    static const int MaxRecords = 64;
+    static const qint64 MaxJournalSize = 4 << 20;
+
+private:
+    QThreadPool pool;
+    QTimer timer;
+    bool enabled = true;
+
+    // Current file and its labels not journaled yet
+    QString fileName;
+    QList<Label> labels;
+    bool dirty = false;
+
+    // Last job queued for each file
+    QHash<QString, QFuture<void>> writes;
+
+    // Files whose automatic writes failed
+    QSet<QString> paused;
+
+    // State of the worker
+    QString file;
+    QList<Label> base;
+    int records = 0;
+    qint64 journalSize = 0;
+};
+
+#endif // AUTOSAVER_H
@@ -0,0 +1,253 @@
+#include "batch.h"
+#include "labelfile.h"
+#include "maskrasterizer.h"
+#include <QtConcurrent>
+#include <cstdio>
+
+bool Batch::isRequested(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i)
+        if (!qstrcmp(argv[i], "--convert") || !qstrcmp(argv[i], "--check"))
+            return true;
+    return false;
+}
+
+int Batch::run(int argc, char** argv) {
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Convert or check label files.");
+    parser.addHelpOption();
+    QCommandLineOption convertOption("convert", "Convert labels to masks, JSON or compact label files.", "mask|json|dat");
+    QCommandLineOption checkOption("check", "Only check that label files can be read.");
+    QCommandLineOption outputOption("output", "Write outputs into <dir> instead of next to the inputs.", "dir");
+    QCommandLineOption inPlaceOption("in-place", "Allow outputs to replace their inputs.");
+    QCommandLineOption sizeOption("size", "Size of masks if images cannot be found.", "wxh");
+    QCommandLineOption depthOption("depth", "Bits per pixel of masks, 8 or 16.", "bits", "8");
+    QCommandLineOption jobsOption("jobs", "Number of threads.", "n");
+    parser.addOptions({convertOption, checkOption, outputOption, inPlaceOption, sizeOption, depthOption, jobsOption});
+    parser.addPositionalArgument("paths", "Label files or folders of them.", "<paths>...");
+    parser.process(app);
+
+    Batch batch;
+    if (parser.isSet(convertOption)) {
+        QStringList formats{"mask", "json", "dat"};
+        batch.format = formats.indexOf(parser.value(convertOption));
+        if (batch.format < 0) {
+            fprintf(stderr, "Unknown format %s\n", qPrintable(parser.value(convertOption)));
+            return 2;
+        }
+    }
+    if (parser.isSet(outputOption)) {
+        batch.outputDir = parser.value(outputOption);
+        if (!QDir().mkpath(batch.outputDir)) {
+            fprintf(stderr, "Cannot create %s\n", qPrintable(QDir::toNativeSeparators(batch.outputDir)));
+            return 2;
+        }
+    }
+    if (parser.isSet(sizeOption)) {
+        QStringList parts = parser.value(sizeOption).split('x');
+        if (parts.size() == 2)
+            batch.size = QSize(parts[0].toInt(), parts[1].toInt());
+        if (batch.size.isEmpty()) {
+            fprintf(stderr, "Invalid size %s\n", qPrintable(parser.value(sizeOption)));
+            return 2;
+        }
+    }
+    batch.depth = parser.value(depthOption).toInt();
+    if (batch.depth != 8 && batch.depth != 16) {
+        fprintf(stderr, "Invalid depth %s\n", qPrintable(parser.value(depthOption)));
+        return 2;
+    }
+    if (parser.isSet(jobsOption) && parser.value(jobsOption).toInt() > 0)
+        QThreadPool::globalInstance()->setMaxThreadCount(parser.value(jobsOption).toInt());
+
+    QStringList fileNames = collect(parser.positionalArguments());
+    if (fileNames.isEmpty()) {
+        fprintf(stderr, "No label files given\n");
+        return 2;
+    }
+    if (parser.isSet(convertOption) && !parser.isSet(inPlaceOption)) {
+        for (const QString& fileName: fileNames) {
+            if (QFileInfo(batch.outputName(fileName)).absoluteFilePath() == QFileInfo(fileName).absoluteFilePath()) {
+                fprintf(stderr, "%s would be replaced, use --output or --in-place\n", qPrintable(QDir::toNativeSeparators(fileName)));
+                return 2;
+            }
+        }
+    }
+
+    std::function<Result(const QString&)> check = [&batch] (const QString& fileName) {
+        return batch.check(fileName);
+    };
+    QList<Result> results = QtConcurrent::blockingMapped<QList<Result>>(fileNames, check);
+
+    // Classes are numbered by the sorted tags of all files
+    QStringList tags;
+    for (const Result& result: results)
+        tags << result.tags;
+    tags.sort();
+    tags.removeDuplicates();
+    for (int i = 0; i < tags.size(); ++i)
+        batch.classes.insert(tags[i], i + 1);
+    if (batch.format == Mask && parser.isSet(convertOption) && tags.size() >= 1 << batch.depth) {
+        fprintf(stderr, "Too many tags for %d-bit masks: %d\n", batch.depth, tags.size());
+        return 2;
+    }
+
+    if (parser.isSet(convertOption)) {
+        std::function<Result(const QString&)> convert = [&batch] (const QString& fileName) {
+            return batch.convert(fileName);
+        };
+        QStringList readable;
+        for (int i = 0; i < fileNames.size(); ++i)
+            if (results[i].error.isEmpty())
+                readable << fileNames[i];
+        QList<Result> converted = QtConcurrent::blockingMapped<QList<Result>>(readable, convert);
+        for (int i = 0, j = 0; i < fileNames.size(); ++i)
+            if (results[i].error.isEmpty())
+                results[i] = converted[j++];
+
+        if (batch.format == Mask) {
+            QJsonObject table;
+            for (const QString& tag: tags)
+                table.insert(tag, batch.classes.value(tag));
+            QSaveFile file(QDir(batch.outputDir.isEmpty() ? QFileInfo(fileNames.first()).path() : batch.outputDir).filePath("classes.json"));
+            if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(table).toJson()) < 0 || !file.commit()) {
+                fprintf(stderr, "Cannot write %s\n", qPrintable(QDir::toNativeSeparators(file.fileName())));
+                return 1;
+            }
+        }
+    }
+
+    int failed = 0;
+    for (int i = 0; i < fileNames.size(); ++i) {
+        if (!results[i].error.isEmpty()) {
+            fprintf(stderr, "%s: %s\n", qPrintable(QDir::toNativeSeparators(fileNames[i])), qPrintable(results[i].error));
+            ++failed;
+        }
+    }
+    fprintf(stderr, "%d of %d files processed\n", fileNames.size() - failed, fileNames.size());
+    return failed ? 1 : 0;
+}
+
+QStringList Batch::collect(const QStringList& paths) {
+    QStringList fileNames;
+    for (const QString& path: paths) {
+        QFileInfo info(path);
+        if (info.isDir()) {
+            QDir dir(path);
+            for (const QString& fileName: dir.entryList({"*.dat"}, QDir::Files, QDir::Name))
+                fileNames << dir.filePath(fileName);
+        } else {
+            fileNames << path;
+        }
+    }
+    fileNames.sort();
+    fileNames.removeDuplicates();
+    return fileNames;
+}
+
+Batch::Result Batch::check(const QString& fileName) const {
+    Result result;
+    QList<Label> labels;
+    if (!LabelFile::read(fileName, &labels)) {
+        result.error = "malformed or unreadable label file";
+        return result;
+    }
+    for (const Label& label: labels)
+        result.tags << label.tag();
+    return result;
+}
+
+Batch::Result Batch::convert(const QString& fileName) const {
+    Result result;
+    QList<Label> labels;
+    if (!LabelFile::read(fileName, &labels)) {
+        result.error = "malformed or unreadable label file";
+        return result;
+    }
+    QString output;
+    bool ok = false;
+    switch (format) {
+    case Mask: {
+        QSize imgSize = imageSize(fileName);
+        if (imgSize.isEmpty()) {
+            result.error = "image size unknown, use --size";
+            return result;
+        }
+        output = outputName(fileName);
+        ok = toMask(labels, imgSize).save(output, "PNG");
+        break;
+    }
+    case Json: {
+        output = outputName(fileName);
+        QSaveFile file(output);
+        ok = file.open(QIODevice::WriteOnly) && file.write(QJsonDocument(toJson(labels)).toJson()) >= 0 && file.commit();
+        break;
+    }
+    case Dat:
+        output = outputName(fileName);
+        ok = LabelFile::write(output, labels);
+        break;
+    }
+    if (!ok)
+        result.error = QString("cannot write %1").arg(QDir::toNativeSeparators(output));
+    return result;
+}
+
+// Label files are named after their images, as in "a.png.dat"
+QString Batch::outputName(const QString& fileName) const {
+    static const char* suffixes[] = {".mask.png", ".json", ".dat"};
+    QString suffix = suffixes[format];
+    QFileInfo info(fileName);
+    QString base = info.fileName();
+    if (base.endsWith(".dat"))
+        base.chop(4);
+    QDir dir = outputDir.isEmpty() ? info.dir() : QDir(outputDir);
+    return dir.filePath(base + suffix);
+}
+
+QSize Batch::imageSize(const QString& fileName) const {
+    if (fileName.endsWith(".dat")) {
+        QImageReader reader(fileName.left(fileName.size() - 4));
+        reader.setAutoTransform(true);
+        QSize imgSize = reader.size();
+        if (imgSize.isValid()) {
+            if (reader.transformation() & QImageIOHandler::TransformationRotate90)
+                imgSize.transpose();
+            return imgSize;
+        }
+    }
+    return size;
+}
+
+// Pixels hold the class of the last label covering them
+QImage Batch::toMask(const QList<Label>& labels, const QSize& size) const {
+    MaskRasterizer rasterizer(size, depth);
+    for (const Label& label: labels)
+        rasterizer.add(label, classes.value(label.tag()));
+    return rasterizer.render();
+}
+
+QJsonObject Batch::toJson(const QList<Label>& labels) const {
+    static const char* shapes[] = {"rect", "poly", "curve", "region", "mask"};
+    QJsonArray array;
+    for (const Label& label: labels) {
+        QJsonObject object;
+        object.insert("tag", label.tag());
+        object.insert("class", classes.value(label.tag()));
+        if (label.shape >= 0 && label.shape < int(sizeof(shapes)/sizeof(*shapes)))
+            object.insert("shape", shapes[label.shape]);
+        object.insert("color", label.brush().color().name(QColor::HexArgb));
+        // Curves are flattened, and masks are traced into polygons
+        QPainterPath path = label.shape == Label::Mask ? label.mask.toPath() : label.path;
+        QJsonArray polygons;
+        for (const QPolygonF& polygon: path.toSubpathPolygons()) {
+            QJsonArray points;
+            for (const QPointF& pt: polygon)
+                points.append(QJsonArray{pt.x(), pt.y()});
+            polygons.append(points);
+        }
+        object.insert("polygons", polygons);
+        array.append(object);
+    }
+    return QJsonObject{{"labels", array}};
+}
@@ -0,0 +1,58 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <QtGui>
+#include "label.h"
+
+// Process label files from the command line without any window
+//
+//   Labeling --convert mask|json|dat [--output <dir>] [--in-place] [--size <w>x<h>] [--depth 8|16] [--jobs <n>] <files or folders>...
+//   Labeling --check <files or folders>...
+//
+// Files are processed in parallel, and each output only depends on its input
+// and on the sorted set of tags, so runs over the same files give the same outputs.
+// An output that would replace its own input, such as converting to dat without --output,
+// is refused unless --in-place is given, since legacy coordinates lose precision in the compact format.
+// The exit code is non-zero if any file cannot be read or written.
+
+class Batch {
+public:
+    enum Format {Mask, Json, Dat};
+
+    struct Result {
+        QString error;
+        QStringList tags;
+    };
+
+public:
+    // Whether the arguments ask for batch mode instead of the GUI
+    static bool isRequested(int argc, char** argv);
+
+    static int run(int argc, char** argv);
+
+private:
+    // Label files given directly or found in folders, sorted
+    static QStringList collect(const QStringList& paths);
+
+    Result check(const QString& fileName) const;
+    Result convert(const QString& fileName) const;
+
+    QString outputName(const QString& fileName) const;
+
+    // Size of the image a label file belongs to
+    QSize imageSize(const QString& fileName) const;
+
+    QImage toMask(const QList<Label>& labels, const QSize& size) const;
+    QJsonObject toJson(const QList<Label>& labels) const;
+
+private:
+    int format = Mask;
+    QString outputDir;
+    QSize size;
+    int depth = 8;
+
+    // Class of each tag in masks, starting from 1 since 0 is the background
+    QHash<QString, int> classes;
+};
+
+#endif // BATCH_H
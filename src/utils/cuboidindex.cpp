@@ -0,0 +1,60 @@
+#include "cuboidindex.h"
+
+bool CuboidIndex::Sweep::isVisible(int i) const {
+    return started[i] && !ended[i];
+}
+
+void CuboidIndex::build(const QList<CuboidLabel>& labels) {
+    for (int axis: {X, Y, Z}) {
+        Sweep& s = sweeps[axis];
+        s = Sweep();
+        for (int i = 0; i < labels.size(); ++i) {
+            const CuboidLabel& l = labels[i];
+            int lo = axis == X ? l.x1 : axis == Y ? l.y1 : l.z1;
+            int hi = axis == X ? l.x2 : axis == Y ? l.y2 : l.z2;
+            s.starts << qMakePair(lo, i);
+            s.ends << qMakePair(hi, i);
+        }
+        std::sort(s.starts.begin(), s.starts.end());
+        std::sort(s.ends.begin(), s.ends.end());
+        s.started.fill(false, labels.size());
+        s.ended.fill(false, labels.size());
+    }
+}
+
+bool CuboidIndex::moveTo(int axis, int pos) {
+    Sweep& s = sweeps[axis];
+    bool changed = s.dirty;
+    s.dirty = false;
+
+    // A cuboid passed over in a single move may be reported as a change
+    auto toggle = [&] (QVector<bool>& flags, int i, bool value) {
+        bool before = s.isVisible(i);
+        flags[i] = value;
+        if (before != s.isVisible(i))
+            changed = true;
+    };
+
+    // Cuboids start at or before the slice
+    int n = s.starts.size();
+    while (s.startCount < n && s.starts[s.startCount].first <= pos)
+        toggle(s.started, s.starts[s.startCount++].second, true);
+    while (s.startCount > 0 && s.starts[s.startCount - 1].first > pos)
+        toggle(s.started, s.starts[--s.startCount].second, false);
+
+    // Cuboids end before the slice
+    while (s.endCount < n && s.ends[s.endCount].first < pos)
+        toggle(s.ended, s.ends[s.endCount++].second, true);
+    while (s.endCount > 0 && s.ends[s.endCount - 1].first >= pos)
+        toggle(s.ended, s.ends[--s.endCount].second, false);
+    return changed;
+}
+
+QVector<int> CuboidIndex::visible(int axis) const {
+    const Sweep& s = sweeps[axis];
+    QVector<int> result;
+    for (int i = 0; i < s.started.size(); ++i)
+        if (s.isVisible(i))
+            result << i;
+    return result;
+}
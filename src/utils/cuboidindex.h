@@ -0,0 +1,47 @@
+#ifndef CUBOIDINDEX_H
+#define CUBOIDINDEX_H
+
+#include <QtGui>
+#include "cuboidlabel.h"
+
+// Sorted endpoints of cuboids along each axis
+// Moving a slice only visits the cuboids entering or leaving it
+
+class CuboidIndex {
+public:
+    enum Axis {X, Y, Z};
+
+public:
+    void build(const QList<CuboidLabel>& labels);
+
+    // Move the slice of an axis
+    // Return whether the set of cuboids cut by the slice may have changed
+    bool moveTo(int axis, int pos);
+
+    // Indices of cuboids cut by the slice of an axis in ascending order
+    QVector<int> visible(int axis) const;
+
+private:
+    struct Sweep {
+        bool isVisible(int i) const;
+
+        // Pairs of coordinate and index sorted by coordinate
+        QVector<QPair<int, int>> starts;
+        QVector<QPair<int, int>> ends;
+
+        // Number of passed starts and ends
+        int startCount = 0;
+        int endCount = 0;
+
+        // Whether the start or the end of each cuboid is passed
+        QVector<bool> started;
+        QVector<bool> ended;
+
+        // Set after building so that the first move reports a change
+        bool dirty = true;
+    };
+
+    Sweep sweeps[3];
+};
+
+#endif // CUBOIDINDEX_H
@@ -0,0 +1,315 @@
+#include "datasetindex.h"
+#include "renderarea.h"
+#include "autosaver.h"
+#include <cstring>
+
+const char DatasetIndex::Magic[4] = {'L', 'B', 'L', 'I'};
+const int DatasetIndex::Version;
+const int DatasetIndex::SaveInterval;
+
+DatasetIndex::DatasetIndex(QObject* parent) :
+    QObject(parent)
+{
+    pool.setMaxThreadCount(1);
+}
+
+DatasetIndex::~DatasetIndex() {
+    close();
+    pool.waitForDone();
+}
+
+void DatasetIndex::open(const QString& path) {
+    close();
+    this->path = path;
+    int current = generation.load();
+    queued.ref();
+    QtConcurrent::run(&pool, [=] () {
+        if (current == generation.load())
+            load(path);
+        queued.deref();
+    });
+}
+
+void DatasetIndex::close() {
+    generation.fetchAndAddOrdered(1);
+    path.clear();
+    // Stale batches finish without touching the new entries
+    QtConcurrent::run(&pool, [=] () {
+        QMutexLocker locker(&mutex);
+        entries.clear();
+        added.clear();
+        dirty = false;
+    });
+}
+
+bool DatasetIndex::isOpen() const {
+    return !path.isEmpty();
+}
+
+void DatasetIndex::add(const QStringList& fileNames) {
+    if (path.isEmpty())
+        return;
+    QString path = this->path;
+    int current = generation.load();
+    queued.ref();
+    QtConcurrent::run(&pool, [=] () {
+        update(path, fileNames, current);
+        queued.deref();
+    });
+}
+
+void DatasetIndex::refresh(const QString& fileName) {
+    if (path.isEmpty() || QFileInfo(fileName).absolutePath() != QFileInfo(path).absoluteFilePath())
+        return;
+    QString path = this->path;
+    int current = generation.load();
+    queued.ref();
+    QtConcurrent::run(&pool, [=] () {
+        {
+            // Force the label file to be read again
+            QMutexLocker locker(&mutex);
+            entries.remove(fileName);
+        }
+        update(path, {fileName}, current);
+        queued.deref();
+    });
+}
+
+void DatasetIndex::prune() {
+    if (path.isEmpty())
+        return;
+    QString path = this->path;
+    int current = generation.load();
+    queued.ref();
+    QtConcurrent::run(&pool, [=] () {
+        if (current == generation.load()) {
+            QMutexLocker locker(&mutex);
+            for (auto it = entries.begin(); it != entries.end();) {
+                if (added.contains(it.key()))
+                    ++it;
+                else {
+                    it = entries.erase(it);
+                    dirty = true;
+                }
+            }
+            locker.unlock();
+            if (dirty) {
+                save(path);
+                dirty = false;
+                lastSave.start();
+            }
+            QMetaObject::invokeMethod(this, [=] () {
+                if (current == generation.load())
+                    emit updated();
+            }, Qt::QueuedConnection);
+        }
+        queued.deref();
+    });
+}
+
+bool DatasetIndex::isReady() const {
+    return queued.load() == 0;
+}
+
+template <typename Predicate>
+int DatasetIndex::find(const QStringList& fileNames, int from, Predicate predicate) const {
+    QMutexLocker locker(&mutex);
+    int n = fileNames.size();
+    for (int i = 1; i <= n; ++i) {
+        int index = (from + i) % n;
+        auto it = entries.constFind(fileNames[index]);
+        if (it != entries.constEnd() && predicate(*it))
+            return index;
+    }
+    return -1;
+}
+
+int DatasetIndex::nextWithTag(const QStringList& fileNames, int from, const QString& tag) const {
+    return find(fileNames, from, [&] (const Entry& entry) {
+        return entry.tags.contains(tag);
+    });
+}
+
+int DatasetIndex::nextUnlabeled(const QStringList& fileNames, int from) const {
+    return find(fileNames, from, [] (const Entry& entry) {
+        return entry.labelCount == 0;
+    });
+}
+
+// Entries of images not added are left until the index is pruned
+
+int DatasetIndex::count() const {
+    QMutexLocker locker(&mutex);
+    int count = 0;
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+        if (added.contains(it.key()))
+            ++count;
+    return count;
+}
+
+int DatasetIndex::labeledCount() const {
+    QMutexLocker locker(&mutex);
+    int count = 0;
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+        if (it->labelCount > 0 && added.contains(it.key()))
+            ++count;
+    return count;
+}
+
+QMap<QString, int> DatasetIndex::tagCounts() const {
+    QMutexLocker locker(&mutex);
+    QMap<QString, int> counts;
+    for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+        if (!added.contains(entry.key()))
+            continue;
+        for (auto it = entry->tags.begin(); it != entry->tags.end(); ++it)
+            ++counts[it.key()];
+    }
+    return counts;
+}
+
+DatasetIndex::Entry DatasetIndex::read(const QString& fileName) {
+    Entry entry;
+    QFileInfo info(fileName+".dat");
+    if (!info.exists())
+        return entry;
+    entry.modified = info.lastModified().toMSecsSinceEpoch();
+    entry.size = info.size();
+    // Only tags are needed so labels and their styles are not created
+    QList<LabelFile::Summary> summaries;
+    if (!QFile::exists(AutoSaver::journalName(fileName+".dat"))) {
+        LabelFile::read(fileName+".dat", &summaries);
+    } else {
+        // A journal left by a crash is rare, and the labels are released right after
+        QList<Label> labels = RenderArea::readLabels(fileName+".dat");
+        AutoSaver::recover(fileName+".dat", &labels);
+        for (const Label& label: labels)
+            summaries << LabelFile::Summary{label.tag(), label.boundingRect()};
+    }
+    entry.labelCount = summaries.size();
+    for (const LabelFile::Summary& summary: summaries) {
+        Stat& stat = entry.tags[summary.tag];
+        ++stat.count;
+        stat.bounds |= summary.bounds;
+    }
+    return entry;
+}
+
+QString DatasetIndex::indexName(const QString& path) {
+    return QDir(path).filePath(".labeling-index");
+}
+
+void DatasetIndex::update(const QString& path, const QStringList& fileNames, int current) {
+    if (current != generation.load())
+        return;
+    // Only label files changed since they were indexed are read
+    QStringList stale;
+    {
+        QMutexLocker locker(&mutex);
+        for (const QString& fileName: fileNames) {
+            added.insert(fileName);
+            auto it = entries.constFind(fileName);
+            if (it == entries.constEnd()) {
+                stale << fileName;
+                continue;
+            }
+            QFileInfo info(fileName+".dat");
+            qint64 modified = info.exists() ? info.lastModified().toMSecsSinceEpoch() : -1;
+            qint64 size = info.exists() ? info.size() : -1;
+            if (it->modified != modified || it->size != size)
+                stale << fileName;
+        }
+    }
+    std::function<Entry(const QString&)> reader = [=] (const QString& fileName) {
+        if (current != generation.load())
+            return Entry();
+        return read(fileName);
+    };
+    QList<Entry> results = QtConcurrent::blockingMapped<QList<Entry>>(stale, reader);
+    if (current != generation.load())
+        return;
+    {
+        QMutexLocker locker(&mutex);
+        for (int i = 0; i < stale.size(); ++i)
+            entries.insert(stale[i], results[i]);
+    }
+    // Saving rewrites the whole index so it waits for the last queued batch
+    if (!stale.isEmpty())
+        dirty = true;
+    if (dirty && (queued.load() <= 1 || !lastSave.isValid() || lastSave.elapsed() >= SaveInterval)) {
+        save(path);
+        dirty = false;
+        lastSave.start();
+    }
+    QMetaObject::invokeMethod(this, [=] () {
+        if (current == generation.load())
+            emit updated();
+    }, Qt::QueuedConnection);
+}
+
+bool DatasetIndex::load(const QString& path) {
+    QFile file(indexName(path));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    char magic[4];
+    qint32 version;
+    if (in.readRawData(magic, 4) != 4 || memcmp(magic, Magic, 4) != 0)
+        return false;
+    in >> version;
+    if (version != Version)
+        return false;
+    QDir dir(path);
+    QHash<QString, Entry> loaded;
+    quint32 count;
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString name;
+        Entry entry;
+        in >> name >> entry;
+        loaded.insert(dir.filePath(name), entry);
+    }
+    if (in.status() != QDataStream::Ok)
+        return false;
+    QMutexLocker locker(&mutex);
+    entries = loaded;
+    return true;
+}
+
+bool DatasetIndex::save(const QString& path) const {
+    // Written by the worker only so there's no other writer
+    QSaveFile file(indexName(path));
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out.writeRawData(Magic, 4);
+    out << qint32(Version);
+    QMutexLocker locker(&mutex);
+    out << quint32(entries.size());
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+        out << QFileInfo(it.key()).fileName() << it.value();
+    locker.unlock();
+    return file.commit();
+}
+
+QDataStream& operator<<(QDataStream& o, const DatasetIndex::Stat& s) {
+    return o << qint32(s.count) << s.bounds;
+}
+
+QDataStream& operator>>(QDataStream& i, DatasetIndex::Stat& s) {
+    qint32 count;
+    i >> count >> s.bounds;
+    s.count = count;
+    return i;
+}
+
+QDataStream& operator<<(QDataStream& o, const DatasetIndex::Entry& e) {
+    return o << e.modified << e.size << qint32(e.labelCount) << e.tags;
+}
+
+QDataStream& operator>>(QDataStream& i, DatasetIndex::Entry& e) {
+    qint32 labelCount;
+    i >> e.modified >> e.size >> labelCount >> e.tags;
+    e.labelCount = labelCount;
+    return i;
+}
@@ -0,0 +1,116 @@
+#ifndef DATASETINDEX_H
+#define DATASETINDEX_H
+
+#include <QtGui>
+#include <QtConcurrent>
+#include "label.h"
+
+// Summary of the label files of a folder
+// Tag counts and bounds of each image are read from its label file in parallel
+// and saved to an index file in the folder, so that only label files changed since are read again.
+// Queries only look up the summaries and never read label files.
+
+class DatasetIndex : public QObject {
+    Q_OBJECT
+
+public:
+    struct Stat {
+        int count = 0;
+
+        // Union of the bounding rects of the labels with the tag
+        QRectF bounds;
+    };
+
+    struct Entry {
+        // Of the label file when it was read, -1 if it didn't exist
+        qint64 modified = -1;
+        qint64 size = -1;
+
+        int labelCount = 0;
+        QHash<QString, Stat> tags;
+    };
+
+public:
+    explicit DatasetIndex(QObject* parent = nullptr);
+    ~DatasetIndex();
+
+    // Load the index file of a folder, dropping the previous folder
+    void open(const QString& path);
+    void close();
+
+    bool isOpen() const;
+
+    // Index images of the folder, only reading label files changed since the last time
+    void add(const QStringList& fileNames);
+
+    // Read the label file of an image again after it's written
+    void refresh(const QString& fileName);
+
+    // Drop images of the index file that weren't added, once the whole folder is added
+    void prune();
+
+    // Whether all added images are indexed
+    bool isReady() const;
+
+    // Index of the next image after from in the list, wrapping around, -1 if none
+    // Images not indexed yet are skipped
+    int nextWithTag(const QStringList& fileNames, int from, const QString& tag) const;
+    int nextUnlabeled(const QStringList& fileNames, int from) const;
+
+    // Number of indexed and labeled images among the added ones
+    int count() const;
+    int labeledCount() const;
+
+    // Number of added images with each tag
+    QMap<QString, int> tagCounts() const;
+
+    // Read the summary of the label file of an image
+    static Entry read(const QString& fileName);
+
+    static QString indexName(const QString& path);
+
+signals:
+    // Emitted after a batch of images is indexed or the index is pruned
+    void updated();
+
+private:
+    template <typename Predicate>
+    int find(const QStringList& fileNames, int from, Predicate predicate) const;
+
+    // Run on the worker thread
+    void update(const QString& path, const QStringList& fileNames, int generation);
+    bool load(const QString& path);
+    bool save(const QString& path) const;
+
+    static const char Magic[4];
+    static const int Version = 1;
+
+    // Longest time in milliseconds before indexed batches are saved
+    static const int SaveInterval = 10000;
+
+private:
+    // Batches run in order on a single thread, each reading its files in parallel
+    QThreadPool pool;
+
+    QString path;
+    QAtomicInt generation;
+    QAtomicInt queued;
+
+    // Keyed by the absolute path of the image, shared with the worker
+    mutable QMutex mutex;
+    QHash<QString, Entry> entries;
+
+    // Images added since the folder was opened, the others may no longer exist
+    QSet<QString> added;
+
+    // Only used by the worker
+    bool dirty = false;
+    QElapsedTimer lastSave;
+};
+
+QDataStream& operator<<(QDataStream& o, const DatasetIndex::Stat& s);
+QDataStream& operator>>(QDataStream& i, DatasetIndex::Stat& s);
+QDataStream& operator<<(QDataStream& o, const DatasetIndex::Entry& e);
+QDataStream& operator>>(QDataStream& i, DatasetIndex::Entry& e);
+
+#endif // DATASETINDEX_H
@@ -0,0 +1,134 @@
+#include "folderscanner.h"
+#include "util.h"
+
+const int FolderScanner::BatchSize;
+const int FolderScanner::BatchInterval;
+const int FolderScanner::RescanDelay;
+const int FolderScanner::RescanFactor;
+
+FolderScanner::FolderScanner(QObject* parent) :
+    QObject(parent)
+{
+    // Scans of the same folder must not overlap
+    pool.setMaxThreadCount(1);
+    timer.setSingleShot(true);
+    connect(&timer, &QTimer::timeout, this, &FolderScanner::schedule);
+    connect(&watcher, &QFileSystemWatcher::directoryChanged, this, &FolderScanner::changed);
+}
+
+FolderScanner::~FolderScanner() {
+    stop();
+    pool.waitForDone();
+}
+
+void FolderScanner::scan(const QString& path) {
+    stop();
+    this->path = path;
+    scanning = true;
+    // Files arriving during the scan are picked up by a rescan queued after it
+    watcher.addPath(path);
+    run(true);
+}
+
+void FolderScanner::stop() {
+    generation.fetchAndAddOrdered(1);
+    timer.stop();
+    if (!watcher.directories().isEmpty())
+        watcher.removePaths(watcher.directories());
+    path.clear();
+    scanning = false;
+    busy = false;
+    pending = false;
+    lastDuration = 0;
+    lastScan.invalidate();
+}
+
+bool FolderScanner::isScanning() const {
+    return scanning;
+}
+
+void FolderScanner::run(bool first) {
+    QString path = this->path;
+    int current = generation.load();
+    busy = true;
+    QtConcurrent::run(&pool, [=] () {
+        if (first)
+            seen.clear();
+        QElapsedTimer clock;
+        clock.start();
+        if (!enumerate(path, current))
+            return;
+        qint64 duration = clock.elapsed();
+        QMetaObject::invokeMethod(this, [=] () {
+            if (current != generation.load())
+                return;
+            busy = false;
+            lastDuration = duration;
+            lastScan.start();
+            if (scanning) {
+                scanning = false;
+                emit finished();
+            }
+            if (pending) {
+                pending = false;
+                timer.start(RescanDelay);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+bool FolderScanner::enumerate(const QString& path, int current) {
+    QDirIterator it(path, imageFilters(), QDir::Files);
+    QStringList batch;
+    QElapsedTimer clock;
+    clock.start();
+    auto deliver = [&] () {
+        if (batch.isEmpty())
+            return;
+        QMetaObject::invokeMethod(this, [=] () {
+            if (current == generation.load())
+                emit found(batch);
+        }, Qt::QueuedConnection);
+        batch.clear();
+        clock.restart();
+    };
+    while (it.hasNext()) {
+        if (current != generation.load())
+            return false;
+        QString fileName = it.next();
+        if (seen.contains(fileName))
+            continue;
+        seen.insert(fileName);
+        batch << fileName;
+        // The first file is delivered alone so that it can be opened without waiting for a batch
+        if (seen.size() == 1 || batch.size() >= BatchSize || clock.elapsed() >= BatchInterval)
+            deliver();
+    }
+    deliver();
+    return true;
+}
+
+void FolderScanner::changed() {
+    // Not restarted by later changes so that a steady stream of them can't hold off the rescan
+    if (!timer.isActive())
+        timer.start(RescanDelay);
+}
+
+void FolderScanner::schedule() {
+    if (path.isEmpty())
+        return;
+    // The app's own label files, journals and index also change the folder, but the watcher
+    // doesn't tell which files changed, so a new image could come with any change
+    if (busy) {
+        pending = true;
+        return;
+    }
+    qint64 wait = lastScan.isValid() ? lastDuration*RescanFactor - lastScan.elapsed() : 0;
+    if (wait > 0) {
+        timer.start(int(wait));
+        return;
+    }
+    // The watcher only reports that the folder changed, so names are enumerated again
+    // but only new files are delivered
+    run(false);
+}
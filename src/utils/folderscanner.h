@@ -0,0 +1,79 @@
+#ifndef FOLDERSCANNER_H
+#define FOLDERSCANNER_H
+
+#include <QtGui>
+#include <QtConcurrent>
+
+// Enumerate the images of a folder on a worker thread
+// Files are delivered in batches as they are found so that the first ones can be opened at once.
+// The folder is then watched and only images not seen before are delivered.
+// Every change leads to a rescan, but rescans of a folder that is slow to enumerate
+// are kept further apart.
+
+class FolderScanner : public QObject {
+    Q_OBJECT
+
+public:
+    explicit FolderScanner(QObject* parent = nullptr);
+    ~FolderScanner();
+
+    // Stop the previous scan and start a new one
+    void scan(const QString& path);
+
+    // Drop batches not delivered yet and stop watching
+    void stop();
+
+    bool isScanning() const;
+
+signals:
+    // Paths of images found since the last batch, in directory order
+    void found(const QStringList& fileNames);
+
+    // Emitted once when the first scan of the folder is done
+    void finished();
+
+private:
+    // Enumerate the folder on the worker, the first time with nothing seen
+    void run(bool first);
+
+    // Run on the worker thread, return false if cancelled
+    bool enumerate(const QString& path, int generation);
+
+    void changed();
+
+    // Rescan after the folder changes, coalescing bursts of changes
+    void schedule();
+
+    // Number of files per batch and the longest wait before one is delivered
+    static const int BatchSize = 512;
+    static const int BatchInterval = 100;
+
+    // Changes are coalesced for the delay, and a rescan waits at least the factor times
+    // as long as the last enumeration took since it finished
+    static const int RescanDelay = 500;
+    static const int RescanFactor = 10;
+
+private:
+    QThreadPool pool;
+    QFileSystemWatcher watcher;
+    QTimer timer;
+
+    QString path;
+    bool scanning = false;
+
+    // Whether an enumeration is running and whether a rescan is needed after it
+    bool busy = false;
+    bool pending = false;
+
+    // Duration of the last enumeration and the time since it finished
+    qint64 lastDuration = 0;
+    QElapsedTimer lastScan;
+
+    // Scans of older generations are cancelled
+    QAtomicInt generation;
+
+    // Files delivered so far, only used by the worker
+    QSet<QString> seen;
+};
+
+#endif // FOLDERSCANNER_H
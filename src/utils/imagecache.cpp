@@ -0,0 +1,137 @@
+#include "imagecache.h"
+#include "tiledecoder.h"
+#include "autosaver.h"
+#include "labelfile.h"
+
+ImageCache::ImageCache() :
+    cache(1 << 20)
+{
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount()/2));
+}
+
+ImageCache::~ImageCache() {
+    {
+        QMutexLocker locker(&mutex);
+        wanted.clear();
+    }
+    pool.waitForDone();
+}
+
+void ImageCache::setRadius(int radius) {
+    this->radius = radius;
+}
+
+void ImageCache::setMemoryBudget(qint64 bytes) {
+    cache.setMaxCost(int(qMin<qint64>(bytes >> 10, INT_MAX)));
+}
+
+ImageCache::Entry ImageCache::get(const QString& fileName) {
+    collect();
+    if (Entry* entry = cache.object(fileName))
+        return *entry;
+    Entry entry;
+    if (pending.contains(fileName)) {
+        {
+            QMutexLocker locker(&mutex);
+            wanted.insert(fileName);
+        }
+        entry = pending.take(fileName).result();
+    }
+    // The request may be skipped before it's wanted again
+    if (isSkipped(entry))
+        entry = read(fileName);
+    insert(fileName, entry);
+    return entry;
+}
+
+void ImageCache::prefetch(const QStringList& fileNames, int index) {
+    // Nearer entries are decoded first
+    QStringList window;
+    for (int d = 1; d <= radius; ++d)
+        for (int i: {index + d, index - d})
+            if (i >= 0 && i < fileNames.size())
+                window << fileNames[i];
+    {
+        QMutexLocker locker(&mutex);
+        wanted.clear();
+        for (const QString& fileName: window)
+            wanted.insert(fileName);
+    }
+    collect();
+    for (const QString& fileName: window)
+        if (!cache.contains(fileName) && !pending.contains(fileName))
+            schedule(fileName);
+}
+
+void ImageCache::invalidate(const QString& fileName) {
+    cache.remove(fileName);
+    pending.remove(fileName);
+}
+
+void ImageCache::clear() {
+    {
+        QMutexLocker locker(&mutex);
+        wanted.clear();
+    }
+    // Running requests finish on their own and their results are dropped
+    pending.clear();
+    cache.clear();
+}
+
+ImageCache::Entry ImageCache::read(const QString& fileName) {
+    Entry entry;
+    // Opening the image with no labels would let the next edit replace the label file
+    if (QFile::exists(fileName+".dat") && !LabelFile::read(fileName+".dat", &entry.labels)) {
+        entry.error = QString("Cannot read its labels from %1").arg(QDir::toNativeSeparators(fileName+".dat"));
+        return entry;
+    }
+    AutoSaver::recover(fileName+".dat", &entry.labels);
+    if (TileDecoder::prefersTiles(fileName)) {
+        entry.tiled = true;
+        return entry;
+    }
+    QImageReader reader(fileName);
+    reader.setAutoTransform(true);
+    entry.image = reader.read();
+    if (entry.image.isNull()) {
+        entry.error = reader.errorString();
+        entry.labels.clear();
+        return entry;
+    }
+    // Convert here so that the conversion to a pixmap is cheap
+    QImage::Format format = entry.image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    if (entry.image.format() != format)
+        entry.image = entry.image.convertToFormat(format);
+    return entry;
+}
+
+void ImageCache::schedule(const QString& fileName) {
+    pending.insert(fileName, QtConcurrent::run(&pool, [this, fileName] () -> Entry {
+        {
+            QMutexLocker locker(&mutex);
+            if (!wanted.contains(fileName))
+                return Entry();
+        }
+        return read(fileName);
+    }));
+}
+
+void ImageCache::insert(const QString& fileName, const Entry& entry) {
+    if (!entry.image.isNull() || entry.tiled)
+        cache.insert(fileName, new Entry(entry), int(entry.image.sizeInBytes() >> 10) + 1);
+}
+
+void ImageCache::collect() {
+    for (auto it = pending.begin(); it != pending.end();) {
+        if (!it->isFinished()) {
+            ++it;
+            continue;
+        }
+        insert(it.key(), it->result());
+        it = pending.erase(it);
+    }
+}
+
+bool ImageCache::isSkipped(const Entry& entry) {
+    return entry.image.isNull() && entry.error.isEmpty() && !entry.tiled;
+}
@@ -0,0 +1,71 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <QtGui>
+#include <QtConcurrent>
+#include "label.h"
+
+// Decode images and their labels on worker threads ahead of time
+// Keep recently used entries within a memory budget
+
+class ImageCache {
+public:
+    struct Entry {
+        QImage image;
+        QList<Label> labels;
+
+        // Set when the image cannot be decoded
+        QString error;
+
+        // Set instead of the image if it's large enough to be decoded by tiles
+        bool tiled = false;
+    };
+
+public:
+    ImageCache();
+    ~ImageCache();
+
+    // Number of entries to decode before and after the current one
+    void setRadius(int radius);
+    void setMemoryBudget(qint64 bytes);
+
+    // Get an entry, decoding it now if it's neither cached nor in progress
+    Entry get(const QString& fileName);
+
+    // Decode the neighbours of the current entry
+    // Requests out of the new window are skipped if not started yet
+    void prefetch(const QStringList& fileNames, int index);
+
+    // Drop an entry after its files change
+    void invalidate(const QString& fileName);
+    void clear();
+
+    // Decode an image and read its label file
+    static Entry read(const QString& fileName);
+
+private:
+    void schedule(const QString& fileName);
+    void insert(const QString& fileName, const Entry& entry);
+
+    // Move results of finished requests to the cache
+    void collect();
+
+    // Skipped requests return an empty entry without an error
+    static bool isSkipped(const Entry& entry);
+
+private:
+    QThreadPool pool;
+
+    // Files in the current window, shared with workers
+    QMutex mutex;
+    QSet<QString> wanted;
+
+    QHash<QString, QFuture<Entry>> pending;
+
+    // Cost in KiB
+    QCache<QString, Entry> cache;
+
+    int radius = 2;
+};
+
+#endif // IMAGECACHE_H
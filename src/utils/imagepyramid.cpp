@@ -0,0 +1,201 @@
+#include "imagepyramid.h"
+
+const int ImagePyramid::TileSize;
+
+ImagePyramid::ImagePyramid(QObject* parent) :
+    QObject(parent),
+    tiles(256*1024)
+{
+}
+
+ImagePyramid::~ImagePyramid() {
+    generation.fetchAndAddOrdered(1);
+    for (QFuture<void>& future: futures)
+        future.waitForFinished();
+}
+
+void ImagePyramid::setImage(const QImage& img) {
+    reset();
+    int gen = generation.load();
+    if (img.isNull())
+        return;
+    levels << (img.depth() == 32 ? img : img.convertToFormat(QImage::Format_ARGB32_Premultiplied));
+
+    // Levels arrive in order since they are queued from one thread
+    QImage base = levels.first();
+    futures << QtConcurrent::run([this, base, gen] () {
+        QImage level = base;
+        while (qMax(level.width(), level.height()) > TileSize && generation.load() == gen) {
+            level = halve(level);
+            QMetaObject::invokeMethod(this, [this, level, gen] () {
+                if (generation.load() != gen)
+                    return;
+                levels << level;
+                emit changed();
+            }, Qt::QueuedConnection);
+        }
+    });
+}
+
+void ImagePyramid::setSource(TileDecoder* decoder, const QString& fileName) {
+    reset();
+    decoder->cancel();
+    this->decoder = decoder;
+    this->fileName = fileName;
+    sourceSize = TileDecoder::imageSize(fileName);
+    levelCount = 1;
+    while (qMax(sourceSize.width(), sourceSize.height()) >> (levelCount - 1) > TileDecoder::TileSize)
+        ++levelCount;
+    connect(decoder, &TileDecoder::tileReady, this, [this] (const QString& fileName) {
+        if (fileName == this->fileName)
+            emit changed();
+    });
+}
+
+bool ImagePyramid::isNull() const {
+    return levels.isEmpty() && !decoder;
+}
+
+QSize ImagePyramid::size() const {
+    if (decoder)
+        return sourceSize;
+    return levels.isEmpty() ? QSize() : levels.first().size();
+}
+
+void ImagePyramid::setMemoryBudget(qint64 bytes) {
+    tiles.setMaxCost(int(qMin<qint64>(bytes/1024, INT_MAX)));
+}
+
+int ImagePyramid::levelFor(qreal zoom) const {
+    int level = 0;
+    while (level + 1 < levels.size() && zoom*(1 << (level + 1)) <= 1)
+        ++level;
+    return level;
+}
+
+void ImagePyramid::paint(QPainter* painter, const QRect& rect, qreal zoom) {
+    if (decoder) {
+        paintSource(painter, rect, zoom);
+        return;
+    }
+    if (levels.isEmpty())
+        return;
+    int level = levelFor(zoom);
+    const QImage& img = levels[level];
+    // Target pixels for each pixel of the level
+    qreal scale = zoom*(1 << level);
+    QRect src = QRectF(rect.x()/scale, rect.y()/scale, rect.width()/scale, rect.height()/scale).toAlignedRect() & img.rect();
+    if (src.isEmpty())
+        return;
+    painter->save();
+    painter->setRenderHint(QPainter::SmoothPixmapTransform, scale < 1);
+    for (int y = src.top()/TileSize; y <= src.bottom()/TileSize; ++y)
+        for (int x = src.left()/TileSize; x <= src.right()/TileSize; ++x) {
+            QRect tileRect = QRect(x*TileSize, y*TileSize, TileSize, TileSize) & img.rect();
+            // Round both corners so that adjacent tiles share edges without gaps
+            QRect target(QPoint(qRound(tileRect.left()*scale), qRound(tileRect.top()*scale)),
+                         QPoint(qRound((tileRect.right() + 1)*scale) - 1, qRound((tileRect.bottom() + 1)*scale) - 1));
+            painter->drawPixmap(target, tile(level, x, y));
+        }
+    painter->restore();
+}
+
+QImage ImagePyramid::halve(const QImage& img) {
+    QImage half(qMax(1, (img.width() + 1)/2), qMax(1, (img.height() + 1)/2), img.format());
+    for (int y = 0; y < half.height(); ++y) {
+        const QRgb* line1 = reinterpret_cast<const QRgb*>(img.constScanLine(2*y));
+        const QRgb* line2 = reinterpret_cast<const QRgb*>(img.constScanLine(qMin(2*y + 1, img.height() - 1)));
+        QRgb* out = reinterpret_cast<QRgb*>(half.scanLine(y));
+        for (int x = 0; x < half.width(); ++x) {
+            int x1 = 2*x;
+            int x2 = qMin(2*x + 1, img.width() - 1);
+            QRgb p[4] = {line1[x1], line1[x2], line2[x1], line2[x2]};
+            // Sum two channels at once in 16-bit lanes
+            quint32 lo = 0x00020002;
+            quint32 hi = 0x00020002;
+            for (QRgb c: p) {
+                lo += c & 0x00FF00FF;
+                hi += (c >> 8) & 0x00FF00FF;
+            }
+            out[x] = ((lo >> 2) & 0x00FF00FF) | (((hi >> 2) & 0x00FF00FF) << 8);
+        }
+    }
+    return half;
+}
+
+QPixmap ImagePyramid::tile(int level, int x, int y) {
+    quint64 key = quint64(level) << 48 | quint64(y) << 24 | quint64(x);
+    if (QPixmap* pixmap = tiles.object(key))
+        return *pixmap;
+    const QImage& img = levels[level];
+    QRect rect = QRect(x*TileSize, y*TileSize, TileSize, TileSize) & img.rect();
+    QPixmap pixmap = QPixmap::fromImage(img.copy(rect));
+    tiles.insert(key, new QPixmap(pixmap), qMax(1, rect.width()*rect.height()*4/1024));
+    return pixmap;
+}
+
+void ImagePyramid::paintSource(QPainter* painter, const QRect& rect, qreal zoom) {
+    int level = 0;
+    while (level + 1 < levelCount && zoom*(1 << (level + 1)) <= 1)
+        ++level;
+    // Pixels of the image covered by each tile
+    int span = TileDecoder::TileSize << level;
+    QRect bounds(QPoint(), sourceSize);
+    QRect src = QRectF(rect.x()/zoom, rect.y()/zoom, rect.width()/zoom, rect.height()/zoom).toAlignedRect() & bounds;
+    if (src.isEmpty())
+        return;
+    QImage preview = decoder->preview(fileName);
+    qreal ratio = preview.isNull() ? 0 : qreal(preview.width())/sourceSize.width();
+    painter->save();
+    painter->setRenderHint(QPainter::SmoothPixmapTransform, zoom*(1 << level) < 1);
+    // Rows of tiles not decoded yet
+    int missingTop = INT_MAX;
+    int missingBottom = -1;
+    for (int y = src.top()/span; y <= src.bottom()/span; ++y)
+        for (int x = src.left()/span; x <= src.right()/span; ++x) {
+            QRect tileRect = QRect(x*span, y*span, span, span) & bounds;
+            QRect target(QPoint(qRound(tileRect.left()*zoom), qRound(tileRect.top()*zoom)),
+                         QPoint(qRound((tileRect.right() + 1)*zoom) - 1, qRound((tileRect.bottom() + 1)*zoom) - 1));
+            quint64 key = quint64(level) << 48 | quint64(y) << 24 | quint64(x);
+            if (QPixmap* pixmap = tiles.object(key)) {
+                painter->drawPixmap(target, *pixmap);
+                continue;
+            }
+            QImage img = decoder->tile(fileName, level, x, y);
+            if (!img.isNull()) {
+                QPixmap pixmap = QPixmap::fromImage(img);
+                tiles.insert(key, new QPixmap(pixmap), qMax(1, img.width()*img.height()*4/1024));
+                painter->drawPixmap(target, pixmap);
+                continue;
+            }
+            missingTop = qMin(missingTop, y);
+            missingBottom = qMax(missingBottom, y);
+            if (!preview.isNull()) {
+                QRectF part(tileRect.x()*ratio, tileRect.y()*ratio, tileRect.width()*ratio, tileRect.height()*ratio);
+                painter->drawImage(QRectF(target), preview, part);
+            }
+        }
+    painter->restore();
+    // The rows in view are decoded together so that the rows above them are only decoded once
+    if (missingBottom >= 0)
+        decoder->request(fileName, level, missingTop, missingBottom);
+}
+
+void ImagePyramid::reset() {
+    generation.fetchAndAddOrdered(1);
+    // Finished workers are forgotten, the others are waited for on destruction
+    for (auto it = futures.begin(); it != futures.end();) {
+        if (it->isFinished())
+            it = futures.erase(it);
+        else
+            ++it;
+    }
+    levels.clear();
+    tiles.clear();
+    if (decoder)
+        disconnect(decoder, nullptr, this, nullptr);
+    decoder = nullptr;
+    fileName.clear();
+    sourceSize = QSize();
+    levelCount = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef IMAGEPYRAMID_H
+#define IMAGEPYRAMID_H
+
+#include <QtGui>
+#include <QtConcurrent>
+#include "tiledecoder.h"
+
+// Draw a large image at any zoom through tiles of a multi-resolution pyramid
+// Level l is the image scaled by 2^-l, so each level halves the previous one.
+// Coarser levels are built in the background; until they are ready the finest level is scaled.
+// Tiles are converted to pixmaps when first drawn and kept in a cache within a memory budget,
+// so only the tiles in view are ever uploaded and blitted.
+// Images too large to decode at once are read from a file through a tile decoder instead,
+// drawing a preview where tiles are not decoded yet.
+
+class ImagePyramid : public QObject {
+    Q_OBJECT
+
+public:
+    explicit ImagePyramid(QObject* parent = nullptr);
+    ~ImagePyramid();
+
+    // The image is shared rather than copied
+    void setImage(const QImage& img);
+
+    // Decode only the tiles in view from the file
+    void setSource(TileDecoder* decoder, const QString& fileName);
+
+    bool isNull() const;
+    QSize size() const;
+
+    void setMemoryBudget(qint64 bytes);
+
+    // Coarsest ready level that still has at least one pixel for each target pixel
+    int levelFor(qreal zoom) const;
+
+    // Draw the part of the image scaled by zoom that falls in rect of the target
+    void paint(QPainter* painter, const QRect& rect, qreal zoom);
+
+    static const int TileSize = 256;
+
+signals:
+    // Emitted when a level or a tile is ready to be drawn
+    void changed();
+
+private:
+    // Average each 2x2 block of a 32-bit image
+    static QImage halve(const QImage& img);
+
+    QPixmap tile(int level, int x, int y);
+
+    void paintSource(QPainter* painter, const QRect& rect, qreal zoom);
+    void reset();
+
+private:
+    QVector<QImage> levels;
+
+    // Only set when drawing from a file
+    TileDecoder* decoder = nullptr;
+    QString fileName;
+    QSize sourceSize;
+    int levelCount = 0;
+
+    // Keyed by level and position, costed in KiB
+    QCache<quint64, QPixmap> tiles;
+
+    // Increased for each image so that outdated levels are dropped
+    QAtomicInt generation;
+
+    // Workers of older images may still be running until they see the generation change
+    QList<QFuture<void>> futures;
+};
+
+#endif // IMAGEPYRAMID_H
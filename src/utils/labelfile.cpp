@@ -0,0 +1,535 @@
+#include "labelfile.h"
+
+namespace {
+
+const char Magic[4] = {'\x89', 'L', 'B', 'L'};
+const quint32 Version = 1;
+
+// Written in the native byte order and checked when reading
+const quint32 ByteOrder = 0x01020304;
+
+enum Kind {Labels, Cuboids};
+
+struct Header {
+    char magic[4];
+    quint32 version;
+    quint32 byteOrder;
+    quint32 kind;
+    quint32 checksum;
+    quint32 count;
+    quint32 stringCount;
+    quint32 styleCount;
+    quint32 elementCount;
+    quint32 reserved;
+
+    // Offsets of sections from the start of the file
+    quint64 strings;
+    quint64 chars;
+    quint64 styles;
+    quint64 records;
+    quint64 types;
+    quint64 coords;
+    quint64 blobs;
+    quint64 size;
+};
+
+// Gradient and texture brushes are stored as solid ones
+struct Style {
+    quint32 penColor;
+    quint32 brushColor;
+    float penWidth;
+    quint16 penStyle;
+    quint16 capStyle;
+    quint16 joinStyle;
+    quint16 brushStyle;
+};
+
+struct Record {
+    quint32 tag;
+    quint32 style;
+    quint32 shape;
+    quint32 fillRule;
+
+    // Range of path elements
+    quint32 first;
+    quint32 count;
+
+    // Range of mask data in the blob section
+    quint32 blob;
+    quint32 blobSize;
+};
+
+struct CuboidRecord {
+    quint32 tag;
+    quint32 style;
+    qint32 x1, y1, z1, x2, y2, z2;
+};
+
+Q_STATIC_ASSERT(sizeof(Header) % 8 == 0);
+
+template <typename T>
+void append(QByteArray& bytes, const T& value) {
+    bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void align(QByteArray& bytes) {
+    while (bytes.size() % 8)
+        bytes.append('\0');
+}
+
+// Collect tags and styles shared by labels
+class Tables {
+public:
+    quint32 string(const QString& str) {
+        auto it = stringIndex.constFind(str);
+        if (it != stringIndex.constEnd())
+            return *it;
+        quint32 index = stringIndex.size();
+        stringIndex.insert(str, index);
+        chars.append(reinterpret_cast<const char*>(str.constData()), str.size()*sizeof(QChar));
+        append(offsets, quint32(chars.size()/sizeof(QChar)));
+        return index;
+    }
+
+    quint32 style(const QPen& pen, const QBrush& brush) {
+        Style s{pen.color().rgba(), brush.color().rgba(), float(pen.widthF()),
+                quint16(pen.style()), quint16(pen.capStyle()), quint16(pen.joinStyle()),
+                quint16(brush.style() < Qt::LinearGradientPattern ? brush.style() : Qt::SolidPattern)};
+        QByteArray key(reinterpret_cast<const char*>(&s), sizeof(s));
+        auto it = styleIndex.constFind(key);
+        if (it != styleIndex.constEnd())
+            return *it;
+        quint32 index = styleIndex.size();
+        styleIndex.insert(key, index);
+        styles.append(key);
+        return index;
+    }
+
+    // Append sections of tables to the body and fill their offsets
+    void write(QByteArray& body, Header& header) const {
+        header.stringCount = stringIndex.size();
+        header.styleCount = styleIndex.size();
+        align(body);
+        header.strings = sizeof(Header) + body.size();
+        append(body, quint32(0));
+        body.append(offsets);
+        align(body);
+        header.chars = sizeof(Header) + body.size();
+        body.append(chars);
+        align(body);
+        header.styles = sizeof(Header) + body.size();
+        body.append(styles);
+    }
+
+private:
+    QHash<QString, quint32> stringIndex;
+
+    // End of each string in characters
+    QByteArray offsets;
+    QByteArray chars;
+
+    QHash<QByteArray, quint32> styleIndex;
+    QByteArray styles;
+};
+
+// Access sections of a mapped file with bounds checking
+class Reader {
+public:
+    Reader(const uchar* data, qint64 size) : data(data), size(size) {}
+
+    bool init(quint32 kind) {
+        if (size < qint64(sizeof(Header)))
+            return false;
+        header = reinterpret_cast<const Header*>(data);
+        if (memcmp(header->magic, Magic, sizeof(Magic)) || header->version != Version || header->byteOrder != ByteOrder)
+            return false;
+        if (header->kind != kind || header->size != quint64(size))
+            return false;
+        if (header->checksum != qChecksum(reinterpret_cast<const char*>(data) + sizeof(Header), uint(size - sizeof(Header))))
+            return false;
+        offsets = section<quint32>(header->strings, quint64(header->stringCount) + 1);
+        styles = section<Style>(header->styles, header->styleCount);
+        if (!offsets || !styles)
+            return false;
+        chars = section<QChar>(header->chars, offsets[header->stringCount]);
+        if (!chars)
+            return false;
+        for (quint32 i = 0; i < header->stringCount; ++i) {
+            if (offsets[i] > offsets[i + 1])
+                return false;
+            strings << QString(chars + offsets[i], offsets[i + 1] - offsets[i]);
+        }
+        return true;
+    }
+
+    template <typename T>
+    const T* section(quint64 offset, quint64 count) const {
+        if (offset % alignof(T) || offset > quint64(size) || count > (quint64(size) - offset)/sizeof(T))
+            return nullptr;
+        return reinterpret_cast<const T*>(data + offset);
+    }
+
+    bool style(quint32 index, QPen* pen, QBrush* brush) const {
+        if (index >= header->styleCount)
+            return false;
+        const Style& s = styles[index];
+        *pen = QPen(QBrush(QColor::fromRgba(s.penColor)), s.penWidth, Qt::PenStyle(s.penStyle), Qt::PenCapStyle(s.capStyle), Qt::PenJoinStyle(s.joinStyle));
+        *brush = QBrush(QColor::fromRgba(s.brushColor), Qt::BrushStyle(s.brushStyle));
+        return true;
+    }
+
+    bool tag(quint32 index, QString* str) const {
+        if (index >= header->stringCount)
+            return false;
+        *str = strings[index];
+        return true;
+    }
+
+    // Intern each pair of tag and style in the file once
+    bool intern(quint32 tagIndex, quint32 styleIndex, StyleRef* ref) {
+        quint64 key = quint64(tagIndex) << 32 | styleIndex;
+        auto it = refs.constFind(key);
+        if (it != refs.constEnd()) {
+            *ref = *it;
+            return true;
+        }
+        QString str;
+        QPen pen;
+        QBrush brush;
+        if (!tag(tagIndex, &str) || !style(styleIndex, &pen, &brush))
+            return false;
+        *ref = StyleRef(str, pen, brush);
+        if (!ref->isValid())
+            return false;
+        refs.insert(key, *ref);
+        return true;
+    }
+
+public:
+    const uchar* data;
+    qint64 size;
+    const Header* header = nullptr;
+
+private:
+    const quint32* offsets = nullptr;
+    const QChar* chars = nullptr;
+    const Style* styles = nullptr;
+
+    // Labels with the same tag share the string
+    QVector<QString> strings;
+
+    QHash<quint64, StyleRef> refs;
+};
+
+bool commit(const QString& fileName, Header& header, const QByteArray& body) {
+    memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.byteOrder = ByteOrder;
+    header.checksum = qChecksum(body.constData(), uint(body.size()));
+    header.size = sizeof(Header) + body.size();
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(body);
+    return file.commit();
+}
+
+template <typename T>
+bool readLegacy(const QString& fileName, QList<T>* labels) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream istream(&file);
+    istream >> *labels;
+    if (istream.status() != QDataStream::Ok) {
+        labels->clear();
+        return false;
+    }
+    return true;
+}
+
+template <typename T>
+bool writeLegacy(const QString& fileName, const QList<T>& labels) {
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream ostream(&file);
+    ostream << labels;
+    return ostream.status() == QDataStream::Ok && file.commit();
+}
+
+}
+
+bool LabelFile::read(const QString& fileName, QList<Label>* labels) {
+    labels->clear();
+    if (!isCompact(fileName))
+        return readLegacy(fileName, labels);
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const uchar* data = file.map(0, file.size());
+    if (!data)
+        return false;
+    Reader reader(data, file.size());
+    if (!reader.init(Labels))
+        return false;
+    const Header* header = reader.header;
+    const Record* records = reader.section<Record>(header->records, header->count);
+    const quint8* types = reader.section<quint8>(header->types, header->elementCount);
+    const float* coords = reader.section<float>(header->coords, quint64(header->elementCount)*2);
+    const char* blobs = reader.section<char>(header->blobs, header->size - header->blobs);
+    if (!records || !types || !coords || !blobs)
+        return false;
+
+    labels->reserve(header->count);
+    for (quint32 n = 0; n < header->count; ++n) {
+        const Record& r = records[n];
+        Label label;
+        label.shape = r.shape;
+        if (r.shape > Label::Mask || r.fillRule > Qt::WindingFill) {
+            labels->clear();
+            return false;
+        }
+        if (!reader.intern(r.tag, r.style, &label.style) || r.first > header->elementCount || r.count > header->elementCount - r.first) {
+            labels->clear();
+            return false;
+        }
+        label.path.setFillRule(Qt::FillRule(r.fillRule));
+        for (quint32 e = r.first; e < r.first + r.count; ++e) {
+            QPointF pt(coords[2*e], coords[2*e + 1]);
+            switch (types[e]) {
+            case QPainterPath::MoveToElement:
+                label.path.moveTo(pt);
+                break;
+            case QPainterPath::LineToElement:
+                label.path.lineTo(pt);
+                break;
+            case QPainterPath::CurveToElement:
+                // Followed by the two other points of the curve
+                if (e + 2 >= r.first + r.count || types[e + 1] != QPainterPath::CurveToDataElement || types[e + 2] != QPainterPath::CurveToDataElement) {
+                    labels->clear();
+                    return false;
+                }
+                label.path.cubicTo(pt, QPointF(coords[2*e + 2], coords[2*e + 3]), QPointF(coords[2*e + 4], coords[2*e + 5]));
+                e += 2;
+                break;
+            default:
+                labels->clear();
+                return false;
+            }
+        }
+        if (r.shape == Label::Mask) {
+            if (r.blob > header->size - header->blobs || r.blobSize > header->size - header->blobs - r.blob) {
+                labels->clear();
+                return false;
+            }
+            QByteArray bytes = QByteArray::fromRawData(blobs + r.blob, r.blobSize);
+            QDataStream istream(bytes);
+            istream >> label.mask;
+            if (istream.status() != QDataStream::Ok) {
+                labels->clear();
+                return false;
+            }
+            label.mask.setColor(label.brush().color());
+        }
+        *labels << label;
+    }
+    return true;
+}
+
+bool LabelFile::read(const QString& fileName, QList<CuboidLabel>* labels) {
+    labels->clear();
+    if (!isCompact(fileName))
+        return readLegacy(fileName, labels);
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const uchar* data = file.map(0, file.size());
+    if (!data)
+        return false;
+    Reader reader(data, file.size());
+    if (!reader.init(Cuboids))
+        return false;
+    const CuboidRecord* records = reader.section<CuboidRecord>(reader.header->records, reader.header->count);
+    if (!records)
+        return false;
+
+    labels->reserve(reader.header->count);
+    for (quint32 n = 0; n < reader.header->count; ++n) {
+        const CuboidRecord& r = records[n];
+        CuboidLabel label;
+        label.x1 = r.x1, label.y1 = r.y1, label.z1 = r.z1;
+        label.x2 = r.x2, label.y2 = r.y2, label.z2 = r.z2;
+        if (!reader.intern(r.tag, r.style, &label.style)) {
+            labels->clear();
+            return false;
+        }
+        *labels << label;
+    }
+    return true;
+}
+
+bool LabelFile::read(const QString& fileName, QList<Summary>* summaries) {
+    summaries->clear();
+    if (!isCompact(fileName)) {
+        // Fields of a label as written by operator<<
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+        QDataStream istream(&file);
+        quint32 count;
+        istream >> count;
+        for (quint32 n = 0; n < count && istream.status() == QDataStream::Ok; ++n) {
+            Summary summary;
+            int shape;
+            QPen pen;
+            QBrush brush;
+            QPainterPath path;
+            istream >> summary.tag >> shape >> pen >> brush >> path;
+            summary.bounds = path.boundingRect();
+            if (shape == Label::Mask) {
+                RegionMask mask;
+                istream >> mask;
+                summary.bounds = mask.boundingRect();
+            }
+            *summaries << summary;
+        }
+        if (istream.status() != QDataStream::Ok) {
+            summaries->clear();
+            return false;
+        }
+        return true;
+    }
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const uchar* data = file.map(0, file.size());
+    if (!data)
+        return false;
+    Reader reader(data, file.size());
+    if (!reader.init(Labels))
+        return false;
+    const Header* header = reader.header;
+    const Record* records = reader.section<Record>(header->records, header->count);
+    const float* coords = reader.section<float>(header->coords, quint64(header->elementCount)*2);
+    const char* blobs = reader.section<char>(header->blobs, header->size - header->blobs);
+    if (!records || !coords || !blobs)
+        return false;
+
+    summaries->reserve(header->count);
+    for (quint32 n = 0; n < header->count; ++n) {
+        const Record& r = records[n];
+        Summary summary;
+        if (r.shape > Label::Mask || !reader.tag(r.tag, &summary.tag) || r.first > header->elementCount || r.count > header->elementCount - r.first) {
+            summaries->clear();
+            return false;
+        }
+        if (r.shape == Label::Mask) {
+            if (r.blob > header->size - header->blobs || r.blobSize > header->size - header->blobs - r.blob) {
+                summaries->clear();
+                return false;
+            }
+            QByteArray bytes = QByteArray::fromRawData(blobs + r.blob, r.blobSize);
+            QDataStream istream(bytes);
+            RegionMask mask;
+            istream >> mask;
+            summary.bounds = mask.boundingRect();
+        } else if (r.count > 0) {
+            // Bounds of the control points, which contain the curves
+            qreal left = coords[2*r.first], right = left;
+            qreal top = coords[2*r.first + 1], bottom = top;
+            for (quint32 e = r.first + 1; e < r.first + r.count; ++e) {
+                left = qMin<qreal>(left, coords[2*e]);
+                right = qMax<qreal>(right, coords[2*e]);
+                top = qMin<qreal>(top, coords[2*e + 1]);
+                bottom = qMax<qreal>(bottom, coords[2*e + 1]);
+            }
+            summary.bounds = QRectF(QPointF(left, top), QPointF(right, bottom));
+        }
+        *summaries << summary;
+    }
+    return true;
+}
+
+bool LabelFile::write(const QString& fileName, const QList<Label>& labels, int format) {
+    // Labels without their style would be written without a tag or color
+    for (const Label& label: labels)
+        if (!label.style.isValid())
+            return false;
+    if (format == Legacy)
+        return writeLegacy(fileName, labels);
+    Tables tables;
+    QByteArray records;
+    QByteArray types;
+    QByteArray coords;
+    QByteArray blobs;
+    quint32 elementCount = 0;
+    for (const Label& label: labels) {
+        Record r{tables.string(label.tag()), tables.style(label.pen(), label.brush()), quint32(label.shape), quint32(label.path.fillRule()),
+                 elementCount, quint32(label.path.elementCount()), 0, 0};
+        for (int e = 0; e < label.path.elementCount(); ++e) {
+            QPainterPath::Element element = label.path.elementAt(e);
+            types.append(char(element.type));
+            append(coords, float(element.x));
+            append(coords, float(element.y));
+        }
+        elementCount += r.count;
+        if (label.shape == Label::Mask) {
+            QByteArray bytes;
+            QDataStream ostream(&bytes, QIODevice::WriteOnly);
+            ostream << label.mask;
+            r.blob = blobs.size();
+            r.blobSize = bytes.size();
+            blobs.append(bytes);
+        }
+        append(records, r);
+    }
+
+    Header header{};
+    header.kind = Labels;
+    header.count = labels.size();
+    header.elementCount = elementCount;
+    QByteArray body;
+    tables.write(body, header);
+    align(body);
+    header.records = sizeof(Header) + body.size();
+    body.append(records);
+    header.types = sizeof(Header) + body.size();
+    body.append(types);
+    align(body);
+    header.coords = sizeof(Header) + body.size();
+    body.append(coords);
+    header.blobs = sizeof(Header) + body.size();
+    body.append(blobs);
+    return commit(fileName, header, body);
+}
+
+bool LabelFile::write(const QString& fileName, const QList<CuboidLabel>& labels, int format) {
+    if (format == Legacy)
+        return writeLegacy(fileName, labels);
+    Tables tables;
+    QByteArray records;
+    for (const CuboidLabel& label: labels) {
+        CuboidRecord r{tables.string(label.tag()), tables.style(label.pen(), label.brush()), label.x1, label.y1, label.z1, label.x2, label.y2, label.z2};
+        append(records, r);
+    }
+
+    Header header{};
+    header.kind = Cuboids;
+    header.count = labels.size();
+    QByteArray body;
+    tables.write(body, header);
+    align(body);
+    header.records = sizeof(Header) + body.size();
+    body.append(records);
+    header.types = header.coords = header.blobs = sizeof(Header) + body.size();
+    return commit(fileName, header, body);
+}
+
+bool LabelFile::isCompact(const QString& fileName) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    return file.read(sizeof(Magic)) == QByteArray(Magic, sizeof(Magic));
+}
@@ -0,0 +1,41 @@
+#ifndef LABELFILE_H
+#define LABELFILE_H
+
+#include <QtGui>
+#include "label.h"
+#include "cuboidlabel.h"
+
+// Read and write label files
+//
+// The compact format starts with a header followed by sections:
+// a string table of tags, a style table of pens and brushes,
+// fixed-size records, path element types, float coordinates and mask data.
+// Sections are aligned so that a mapped file is read in place.
+// Records refer to tags, styles and elements by index, which also serves as an offset index.
+//
+// Files written by QDataStream without a header are still read and can still be written.
+
+class LabelFile {
+public:
+    enum Format {Compact, Legacy};
+
+    // Tag and bounds of a label, read without creating the label or its style
+    struct Summary {
+        QString tag;
+        QRectF bounds;
+    };
+
+public:
+    // Return false if the file is missing or malformed
+    static bool read(const QString& fileName, QList<Label>* labels);
+    static bool read(const QString& fileName, QList<CuboidLabel>* labels);
+    static bool read(const QString& fileName, QList<Summary>* summaries);
+
+    // Written atomically so that a failed save keeps the old file
+    static bool write(const QString& fileName, const QList<Label>& labels, int format = Compact);
+    static bool write(const QString& fileName, const QList<CuboidLabel>& labels, int format = Compact);
+
+    static bool isCompact(const QString& fileName);
+};
+
+#endif // LABELFILE_H
@@ -0,0 +1,53 @@
+#include "labelgrid.h"
+
+void LabelGrid::build(const QList<Label>& labels) {
+    clear();
+    for (int i = 0; i < labels.size(); ++i)
+        insert(i, labels[i].boundingRect());
+}
+
+void LabelGrid::insert(int index, const QRectF& rect) {
+    if (rect.isNull())
+        return;
+    int x1 = cell(rect.left());
+    int y1 = cell(rect.top());
+    int x2 = cell(rect.right());
+    int y2 = cell(rect.bottom());
+    if (qint64(x2 - x1 + 1)*(y2 - y1 + 1) > MaxCells) {
+        large << index;
+        return;
+    }
+    for (int y = y1; y <= y2; ++y)
+        for (int x = x1; x <= x2; ++x)
+            cells[key(x, y)] << index;
+}
+
+void LabelGrid::clear() {
+    cells.clear();
+    large.clear();
+}
+
+QVector<int> LabelGrid::candidates(const QPointF& pos) const {
+    QVector<int> result;
+    QVector<int> local = cells.value(key(cell(pos.x()), cell(pos.y())));
+    result.reserve(local.size() + large.size());
+
+    // Merge two ascending lists from the back
+    int i = local.size() - 1;
+    int j = large.size() - 1;
+    while (i >= 0 || j >= 0) {
+        if (j < 0 || (i >= 0 && local[i] > large[j]))
+            result << local[i--];
+        else
+            result << large[j--];
+    }
+    return result;
+}
+
+quint64 LabelGrid::key(int x, int y) {
+    return quint64(quint32(x)) << 32 | quint32(y);
+}
+
+int LabelGrid::cell(qreal v) {
+    return qFloor(v / CellSize);
+}
@@ -0,0 +1,35 @@
+#ifndef LABELGRID_H
+#define LABELGRID_H
+
+#include <QtGui>
+#include "label.h"
+
+// Uniform grid over bounding rects of labels
+// Used to find the few labels possibly under a point before the exact test
+
+class LabelGrid {
+public:
+    void build(const QList<Label>& labels);
+    void insert(int index, const QRectF& rect);
+    void clear();
+
+    // Indices of labels whose bounding rects may contain the point
+    // Sorted in descending order so that the topmost label comes first
+    QVector<int> candidates(const QPointF& pos) const;
+
+private:
+    static quint64 key(int x, int y);
+    static int cell(qreal v);
+
+    // Size of a cell in pixels
+    static const int CellSize = 64;
+
+    // Labels covering more cells than this are kept in a separate list
+    static const int MaxCells = 256;
+
+    // Indices in each cell are in ascending order
+    QHash<quint64, QVector<int>> cells;
+    QVector<int> large;
+};
+
+#endif // LABELGRID_H
@@ -2,6 +2,7 @@
 #define LISTEX_H
 
 #include <QList>
+#include <algorithm>
 
 // A convenience class providing a list with an iterator
 
@@ -58,6 +59,26 @@ public:
         list.clear();
         it = list.end();
     }
+    // Appending may reallocate the list so the iterator is kept by index
+    void append(const QList<T>& items) {
+        int index = it - list.begin();
+        list.append(items);
+        it = list.begin() + index;
+    }
+    // The iterator stays on the same element
+    template <typename Compare>
+    void sort(Compare compare) {
+        if (atEnd()) {
+            std::sort(list.begin(), list.end(), compare);
+            it = list.end();
+            return;
+        }
+        T current = *it;
+        std::sort(list.begin(), list.end(), compare);
+        // Elements equivalent under the comparison may still differ, as names that only differ by case
+        auto range = std::equal_range(list.begin(), list.end(), current, compare);
+        it = std::find(range.first, range.second, current);
+    }
     QList<T> list;
     typename QList<T>::iterator it;
 };
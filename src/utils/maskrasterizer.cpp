@@ -0,0 +1,216 @@
+#include "maskrasterizer.h"
+#include <QtConcurrent>
+#include <algorithm>
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MASKRASTERIZER_SSE2
+#endif
+
+namespace {
+
+// Span kernels
+
+template <typename T>
+inline void fillSpan(T* dst, int n, int id) {
+    std::fill(dst, dst + n, T(id));
+}
+
+#ifdef MASKRASTERIZER_SSE2
+template <>
+inline void fillSpan<quint8>(quint8* dst, int n, int id) {
+    int x = 0;
+    __m128i v = _mm_set1_epi8(char(id));
+    for (; x + 16 <= n; x += 16)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), v);
+    for (; x < n; ++x)
+        dst[x] = quint8(id);
+}
+
+template <>
+inline void fillSpan<quint16>(quint16* dst, int n, int id) {
+    int x = 0;
+    __m128i v = _mm_set1_epi16(short(id));
+    for (; x + 8 <= n; x += 8)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), v);
+    for (; x < n; ++x)
+        dst[x] = quint16(id);
+}
+#endif
+
+// Set dst[x] to id where src[x] is non-zero
+template <typename T>
+inline void selectSpan(T* dst, const uchar* src, int n, int id) {
+    for (int x = 0; x < n; ++x)
+        if (src[x])
+            dst[x] = T(id);
+}
+
+#ifdef MASKRASTERIZER_SSE2
+template <>
+inline void selectSpan<quint8>(quint8* dst, const uchar* src, int n, int id) {
+    int x = 0;
+    __m128i v = _mm_set1_epi8(char(id));
+    __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= n; x += 16) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + x));
+        __m128i keep = _mm_cmpeq_epi8(s, zero);
+        d = _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, v));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), d);
+    }
+    for (; x < n; ++x)
+        if (src[x])
+            dst[x] = quint8(id);
+}
+#endif
+
+template <typename T>
+inline T* row(uchar* bits, int stride, int y) {
+    return reinterpret_cast<T*>(bits + qptrdiff(y)*stride);
+}
+
+}
+
+const int MaskRasterizer::BandHeight;
+
+MaskRasterizer::MaskRasterizer(const QSize& size, int depth) :
+    size(size),
+    depth(depth == 16 ? 16 : 8)
+{
+}
+
+void MaskRasterizer::add(const Label& label, int id) {
+    if (label.shape == Label::Mask)
+        add(label.mask, id);
+    else
+        add(label.path, id);
+}
+
+void MaskRasterizer::add(const QPainterPath& path, int id) {
+    Shape shape;
+    shape.id = id;
+    shape.winding = path.fillRule() == Qt::WindingFill;
+    // Subpaths are implicitly closed when filled
+    for (const QPolygonF& polygon: path.toSubpathPolygons()) {
+        for (int i = 0; i < polygon.size(); ++i) {
+            QPointF p1 = polygon[i];
+            QPointF p2 = polygon[(i + 1) % polygon.size()];
+            int dir = 1;
+            if (p1.y() > p2.y()) {
+                qSwap(p1, p2);
+                dir = -1;
+            }
+            // Rows whose centers y + 0.5 are in [p1.y, p2.y)
+            int y1 = qCeil(p1.y() - 0.5);
+            int y2 = qCeil(p2.y() - 0.5);
+            if (y1 == y2)
+                continue;
+            double dxdy = (p2.x() - p1.x())/(p2.y() - p1.y());
+            shape.edges << Edge{y1, y2, p1.x() + (y1 + 0.5 - p1.y())*dxdy, dxdy, dir};
+        }
+    }
+    if (shape.edges.isEmpty())
+        return;
+    std::sort(shape.edges.begin(), shape.edges.end(), [] (const Edge& a, const Edge& b) {
+        return a.y1 < b.y1;
+    });
+    shape.rect = path.boundingRect().toAlignedRect().intersected(QRect(QPoint(), size));
+    if (!shape.rect.isEmpty())
+        shapes << shape;
+}
+
+void MaskRasterizer::add(const RegionMask& mask, int id) {
+    Shape shape;
+    shape.id = id;
+    shape.winding = false;
+    shape.rect = mask.boundingRect().intersected(QRect(QPoint(), size));
+    shape.mask = mask;
+    if (!shape.rect.isEmpty())
+        shapes << shape;
+}
+
+QImage MaskRasterizer::render() const {
+    QImage img(size, depth == 16 ? QImage::Format_Grayscale16 : QImage::Format_Grayscale8);
+    if (img.isNull())
+        return img;
+    QVector<int> bands((size.height() + BandHeight - 1)/BandHeight);
+    std::iota(bands.begin(), bands.end(), 0);
+    // Take the pointer once since scanLine() may detach and is not thread safe
+    uchar* bits = img.bits();
+    int stride = img.bytesPerLine();
+    QtConcurrent::blockingMap(bands, [this, bits, stride] (int band) {
+        renderBand(bits, stride, band);
+    });
+    return img;
+}
+
+void MaskRasterizer::renderBand(uchar* bits, int stride, int band) const {
+    int top = band*BandHeight;
+    int bottom = qMin(top + BandHeight, size.height());
+    for (int y = top; y < bottom; ++y)
+        memset(bits + qptrdiff(y)*stride, 0, size.width()*depth/8);
+    for (const Shape& shape: shapes) {
+        if (shape.rect.bottom() < top || shape.rect.top() >= bottom)
+            continue;
+        if (shape.edges.isEmpty())
+            fillMask(bits, stride, shape, qMax(top, shape.rect.top()), qMin(bottom, shape.rect.bottom() + 1));
+        else
+            fillPath(bits, stride, shape, top, bottom);
+    }
+}
+
+void MaskRasterizer::fillPath(uchar* bits, int stride, const Shape& shape, int top, int bottom) const {
+    const QVector<Edge>& edges = shape.edges;
+    QVector<int> active;
+    QVector<QPair<double, int>> crossings;
+    int next = 0;
+    for (int y = top; y < bottom; ++y) {
+        // Update the active edges
+        while (next < edges.size() && edges[next].y1 <= y) {
+            if (edges[next].y2 > y)
+                active << next;
+            ++next;
+        }
+        active.erase(std::remove_if(active.begin(), active.end(), [&edges, y] (int e) {
+            return edges[e].y2 <= y;
+        }), active.end());
+        if (active.isEmpty())
+            continue;
+
+        crossings.clear();
+        for (int e: active)
+            crossings << qMakePair(edges[e].x + (y - edges[e].y1)*edges[e].dxdy, edges[e].dir);
+        std::sort(crossings.begin(), crossings.end());
+
+        // Pixels whose centers x + 0.5 are between a pair of crossings
+        int winding = 0;
+        for (int i = 0; i + 1 < crossings.size(); ++i) {
+            winding += shape.winding ? crossings[i].second : 1;
+            if (shape.winding ? winding == 0 : winding % 2 == 0)
+                continue;
+            int x1 = qBound(0, qCeil(crossings[i].first - 0.5), size.width());
+            int x2 = qBound(0, qCeil(crossings[i + 1].first - 0.5), size.width());
+            if (x1 >= x2)
+                continue;
+            if (depth == 16)
+                fillSpan(row<quint16>(bits, stride, y) + x1, x2 - x1, shape.id);
+            else
+                fillSpan(row<quint8>(bits, stride, y) + x1, x2 - x1, shape.id);
+        }
+    }
+}
+
+void MaskRasterizer::fillMask(uchar* bits, int stride, const Shape& shape, int top, int bottom) const {
+    QRect bounds = shape.mask.boundingRect();
+    int x1 = shape.rect.left();
+    int n = shape.rect.width();
+    for (int y = top; y < bottom; ++y) {
+        const uchar* src = shape.mask.scanLine(y) + (x1 - bounds.left());
+        if (depth == 16)
+            selectSpan(row<quint16>(bits, stride, y) + x1, src, n, shape.id);
+        else
+            selectSpan(row<quint8>(bits, stride, y) + x1, src, n, shape.id);
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef MASKRASTERIZER_H
+#define MASKRASTERIZER_H
+
+#include <QtGui>
+#include "label.h"
+
+// Rasterize labels into a map of class IDs
+// Paths are flattened into edges once when added,
+// then bands of rows are scan-converted on worker threads.
+// Shapes are filled in the order they are added so later ones cover earlier ones.
+// Pixels are covered if their centers are inside a path, without antialiasing.
+
+class MaskRasterizer {
+public:
+    // Depth is 8 or 16 bits per pixel
+    MaskRasterizer(const QSize& size, int depth = 8);
+
+    void add(const Label& label, int id);
+    void add(const QPainterPath& path, int id);
+    void add(const RegionMask& mask, int id);
+
+    // Pixels not covered by any shape are 0
+    QImage render() const;
+
+    static const int BandHeight = 64;
+
+private:
+    struct Edge {
+        // Rows of pixel centers crossing the edge are [y1, y2)
+        int y1, y2;
+
+        // Coordinate x at the center of row y1
+        double x;
+        double dxdy;
+
+        // 1 if the edge goes down, -1 otherwise
+        int dir;
+    };
+
+    struct Shape {
+        int id;
+        QRect rect;
+
+        // Sorted by y1
+        QVector<Edge> edges;
+        bool winding;
+
+        // Only set for masks
+        RegionMask mask;
+    };
+
+    void renderBand(uchar* bits, int stride, int band) const;
+    void fillPath(uchar* bits, int stride, const Shape& shape, int top, int bottom) const;
+    void fillMask(uchar* bits, int stride, const Shape& shape, int top, int bottom) const;
+
+private:
+    QSize size;
+    int depth;
+    QVector<Shape> shapes;
+};
+
+#endif // MASKRASTERIZER_H
@@ -0,0 +1,90 @@
+#include "slicecache.h"
+#include "trace.h"
+
+const int SliceCache::Radius;
+
+SliceCache::SliceCache(const Volume* volume, QObject* parent) :
+    QObject(parent),
+    volume(volume)
+{
+    pool.setMaxThreadCount(1);
+    setMemoryBudget(qint64(384) << 20);
+}
+
+SliceCache::~SliceCache() {
+    clear();
+}
+
+void SliceCache::setMemoryBudget(qint64 bytes) {
+    for (auto& cache: caches)
+        cache.setMaxCost(int(qMin<qint64>(bytes/3 >> 10, INT_MAX)));
+}
+
+QPixmap SliceCache::get(int axis, int index) {
+    TRACE_SCOPE("SliceCache::get");
+    if (QPixmap* pixmap = caches[axis].object(index))
+        return *pixmap;
+    extract(axis, index, &buffers[axis]);
+    QPixmap pixmap = QPixmap::fromImage(buffers[axis]);
+    caches[axis].insert(index, new QPixmap(pixmap), int(buffers[axis].sizeInBytes() >> 10) + 1);
+    return pixmap;
+}
+
+void SliceCache::prefetch(int axis, int index) {
+    centers[axis].store(index);
+    int gen = generation.load();
+    for (int d = 1; d <= Radius; ++d)
+        for (int i: {index + d, index - d}) {
+            if (i < 0 || i >= count(axis) || caches[axis].contains(i) || pending[axis].contains(i))
+                continue;
+            pending[axis].insert(i);
+            QtConcurrent::run(&pool, [this, axis, i, gen] () {
+                QImage img;
+                if (generation.load() == gen && qAbs(i - centers[axis].load()) <= Radius)
+                    extract(axis, i, &img);
+                QMetaObject::invokeMethod(this, [this, axis, i, img, gen] () {
+                    if (generation.load() != gen)
+                        return;
+                    pending[axis].remove(i);
+                    if (!img.isNull())
+                        caches[axis].insert(i, new QPixmap(QPixmap::fromImage(img)), int(img.sizeInBytes() >> 10) + 1);
+                }, Qt::QueuedConnection);
+            });
+        }
+}
+
+void SliceCache::clear() {
+    generation.fetchAndAddOrdered(1);
+    pool.clear();
+    pool.waitForDone();
+    for (int axis = 0; axis < 3; ++axis) {
+        caches[axis].clear();
+        pending[axis].clear();
+    }
+}
+
+void SliceCache::extract(int axis, int index, QImage* img) const {
+    TRACE_SCOPE("SliceCache::extract");
+    switch (axis) {
+    case Top:
+        volume->top(index, img);
+        break;
+    case Left:
+        volume->left(index, img);
+        break;
+    case Front:
+        volume->front(index, img);
+        break;
+    }
+}
+
+int SliceCache::count(int axis) const {
+    switch (axis) {
+    case Top:
+        return volume->depth();
+    case Left:
+        return volume->width();
+    default:
+        return volume->height();
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef SLICECACHE_H
+#define SLICECACHE_H
+
+#include <QtGui>
+#include <QtConcurrent>
+#include "volume.h"
+
+// Keep recently shown slices of a volume as pixmaps
+// Each axis has its own cache within a share of the memory budget.
+// Slices next to the one shown are extracted on a worker thread ahead of time,
+// so scrubbing back and forth over a range only extracts each slice once.
+
+class SliceCache : public QObject {
+    Q_OBJECT
+
+public:
+    enum Axis {Top, Left, Front};
+
+public:
+    explicit SliceCache(const Volume* volume, QObject* parent = nullptr);
+    ~SliceCache();
+
+    void setMemoryBudget(qint64 bytes);
+
+    // Extract the slice now if it's not cached
+    QPixmap get(int axis, int index);
+
+    // Extract the neighbours of a slice in the background, nearest first
+    void prefetch(int axis, int index);
+
+    // Must be called before the volume or its window changes
+    // Wait for the slice being extracted so that the volume is not read any more
+    void clear();
+
+    // Slices on each side of the shown one to extract ahead
+    static const int Radius = 4;
+
+private:
+    void extract(int axis, int index, QImage* img) const;
+    int count(int axis) const;
+
+private:
+    const Volume* volume;
+
+    // Cost in KiB
+    QCache<int, QPixmap> caches[3];
+
+    // Reused to extract slices shown at once
+    QImage buffers[3];
+
+    // One thread so that clear() waits for at most one slice
+    QThreadPool pool;
+    QSet<int> pending[3];
+
+    // Slice last prefetched around on each axis
+    // Requests that moved out of its radius are skipped
+    QAtomicInt centers[3];
+
+    // Increased by clear() so that outdated slices are dropped
+    QAtomicInt generation;
+};
+
+#endif // SLICECACHE_H
@@ -0,0 +1,172 @@
+#ifndef SLOTMAP_H
+#define SLOTMAP_H
+
+#include <QList>
+#include <QVector>
+
+// An ordered list whose elements are also found by stable keys
+// A key stays valid until its element is removed and is never reused after that,
+// since each slot counts how many times it has been reused.
+// Values are kept in a QList so that the whole list can still be copied cheaply.
+
+template <typename T>
+class SlotMap {
+public:
+    // Generation in the high half and slot in the low half, 0 is never a key
+    typedef quint64 Key;
+
+public:
+    const QList<T>& list() const {
+        return values;
+    }
+    int size() const {
+        return values.size();
+    }
+    bool isEmpty() const {
+        return values.isEmpty();
+    }
+    T& operator[](int index) {
+        return values[index];
+    }
+    const T& at(int index) const {
+        return values.at(index);
+    }
+    T& last() {
+        return values.last();
+    }
+    const T& last() const {
+        return values.last();
+    }
+    Key keyAt(int index) const {
+        return keys.at(index);
+    }
+
+    // Position of the element with a key, -1 if it's removed
+    int indexOf(Key key) const {
+        int slot = int(key & 0xFFFFFFFF);
+        if (slot >= slots.size() || slots[slot].generation != key >> 32)
+            return -1;
+        return slots[slot].index;
+    }
+    bool contains(Key key) const {
+        return indexOf(key) >= 0;
+    }
+    T* value(Key key) {
+        int index = indexOf(key);
+        return index < 0 ? nullptr : &values[index];
+    }
+    const T* value(Key key) const {
+        int index = indexOf(key);
+        return index < 0 ? nullptr : &values.at(index);
+    }
+
+    Key append(const T& value) {
+        values.append(value);
+        keys.append(acquire(values.size() - 1));
+        return keys.last();
+    }
+    void removeLast() {
+        release(keys.last());
+        values.removeLast();
+        keys.removeLast();
+    }
+    bool remove(Key key) {
+        int index = indexOf(key);
+        if (index < 0)
+            return false;
+        replace(index, 1, QList<T>());
+        return true;
+    }
+
+    // Remove matching elements in a single pass, return the number removed
+    template <typename Predicate>
+    int removeIf(Predicate predicate) {
+        int n = 0;
+        for (int i = 0; i < values.size(); ++i) {
+            if (predicate(values.at(i))) {
+                release(keys[i]);
+                continue;
+            }
+            if (n != i) {
+                values[n] = values.at(i);
+                keys[n] = keys[i];
+                slots[slotOf(keys[n])].index = n;
+            }
+            ++n;
+        }
+        int removed = values.size() - n;
+        values.erase(values.begin() + n, values.end());
+        keys.resize(n);
+        return removed;
+    }
+
+    // Replace a range of elements, the inserted ones get new keys
+    // Keys of elements out of the range are kept
+    void replace(int index, int count, const QList<T>& inserted) {
+        for (int i = index; i < index + count; ++i)
+            release(keys[i]);
+        values.erase(values.begin() + index, values.begin() + index + count);
+        keys.remove(index, count);
+        for (int i = 0; i < inserted.size(); ++i)
+            values.insert(index + i, inserted.at(i));
+        keys.insert(index, inserted.size(), 0);
+        for (int i = 0; i < inserted.size(); ++i)
+            keys[index + i] = acquire(index + i);
+        // Elements after the range are moved
+        if (count != inserted.size())
+            for (int i = index + inserted.size(); i < keys.size(); ++i)
+                slots[slotOf(keys[i])].index = i;
+    }
+
+    // Replace all elements, all keys become invalid
+    void assign(const QList<T>& list) {
+        clear();
+        values = list;
+        keys.resize(values.size());
+        for (int i = 0; i < values.size(); ++i)
+            keys[i] = acquire(i);
+    }
+    void clear() {
+        for (Key key: keys)
+            release(key);
+        values.clear();
+        keys.clear();
+    }
+
+private:
+    struct Slot {
+        quint32 generation;
+        int index;
+    };
+
+    static int slotOf(Key key) {
+        return int(key & 0xFFFFFFFF);
+    }
+
+    Key acquire(int index) {
+        int slot;
+        if (!freeSlots.isEmpty()) {
+            slot = freeSlots.takeLast();
+        } else {
+            slot = slots.size();
+            slots.append({0, -1});
+        }
+        // Generations start from 1 so that no key is 0
+        if (++slots[slot].generation == 0)
+            slots[slot].generation = 1;
+        slots[slot].index = index;
+        return Key(slots[slot].generation) << 32 | quint32(slot);
+    }
+    void release(Key key) {
+        int slot = slotOf(key);
+        slots[slot].index = -1;
+        freeSlots.append(slot);
+    }
+
+    QList<T> values;
+    QVector<Key> keys;
+    QVector<Slot> slots;
+    QVector<int> freeSlots;
+};
+
+#endif // SLOTMAP_H
@@ -0,0 +1,145 @@
+#include "styletable.h"
+
+const int StyleTable::ChunkBits;
+const int StyleTable::ChunkSize;
+const int StyleTable::MaxChunks;
+const int StyleTable::Invalid;
+
+const StyleTable::Style& StyleTable::get(int id) {
+    return instance()->entry(qMax(id, 0)).style;
+}
+
+int StyleTable::count() {
+    StyleTable* table = instance();
+    QMutexLocker locker(&table->mutex);
+    return table->size - table->freeIds.size();
+}
+
+StyleTable::StyleTable() {
+    // The style of default constructed labels is never released
+    chunks[0].store(new Entry[ChunkSize]);
+    chunks[0].load()[0].alive = true;
+}
+
+StyleTable* StyleTable::instance() {
+    static StyleTable table;
+    return &table;
+}
+
+int StyleTable::intern(const QString& tag, const QPen& pen, const QBrush& brush) {
+    if (tag.isNull() && pen == QPen() && brush == QBrush())
+        return 0;
+    StyleTable* table = instance();
+    uint key = hash(tag, pen, brush);
+    QMutexLocker locker(&table->mutex);
+    for (auto it = table->ids.constFind(key); it != table->ids.constEnd() && it.key() == key; ++it) {
+        Entry& entry = table->entry(it.value());
+        if (entry.style.tag == tag && entry.style.pen == pen && entry.style.brush == brush) {
+            // The entry may be waiting to be freed by a release with no references left
+            entry.refs.ref();
+            return it.value();
+        }
+    }
+    int id;
+    if (!table->freeIds.isEmpty()) {
+        id = table->freeIds.takeLast();
+    } else if (table->size < ChunkSize*MaxChunks) {
+        id = table->size++;
+        if (!table->chunks[id >> ChunkBits].load())
+            table->chunks[id >> ChunkBits].storeRelease(new Entry[ChunkSize]);
+    } else {
+        return Invalid;
+    }
+    Entry& entry = table->entry(id);
+    entry.style = {tag, pen, brush};
+    entry.refs.store(1);
+    entry.key = key;
+    entry.alive = true;
+    table->ids.insert(key, id);
+    return id;
+}
+
+void StyleTable::ref(int id) {
+    if (id > 0)
+        instance()->entry(id).refs.ref();
+}
+
+void StyleTable::release(int id) {
+    if (id <= 0)
+        return;
+    StyleTable* table = instance();
+    Entry& entry = table->entry(id);
+    if (entry.refs.deref())
+        return;
+    QMutexLocker locker(&table->mutex);
+    // Another reference may be taken by intern before the lock, or the entry may be freed already
+    if (!entry.alive || entry.refs.load() != 0)
+        return;
+    entry.alive = false;
+    entry.style = Style();
+    table->ids.remove(entry.key, id);
+    table->freeIds << id;
+}
+
+StyleTable::Entry& StyleTable::entry(int id) {
+    return chunks[id >> ChunkBits].loadAcquire()[id & (ChunkSize - 1)];
+}
+
+uint StyleTable::hash(const QString& tag, const QPen& pen, const QBrush& brush) {
+    uint h = qHash(tag);
+    h = h*31 + pen.color().rgba();
+    h = h*31 + qHash(pen.widthF());
+    h = h*31 + uint(pen.style());
+    h = h*31 + brush.color().rgba();
+    h = h*31 + uint(brush.style());
+    return h;
+}
+
+StyleRef::StyleRef() :
+    styleId(0)
+{
+}
+
+StyleRef::StyleRef(const QString& tag, const QPen& pen, const QBrush& brush) :
+    styleId(StyleTable::intern(tag, pen, brush))
+{
+}
+
+StyleRef::StyleRef(const StyleRef& other) :
+    styleId(other.styleId)
+{
+    StyleTable::ref(styleId);
+}
+
+StyleRef& StyleRef::operator=(const StyleRef& other) {
+    if (styleId != other.styleId) {
+        StyleTable::ref(other.styleId);
+        StyleTable::release(styleId);
+        styleId = other.styleId;
+    }
+    return *this;
+}
+
+StyleRef::~StyleRef() {
+    StyleTable::release(styleId);
+}
+
+int StyleRef::id() const {
+    return styleId;
+}
+
+const StyleTable::Style& StyleRef::get() const {
+    return StyleTable::get(styleId);
+}
+
+bool StyleRef::isValid() const {
+    return styleId != StyleTable::Invalid;
+}
+
+bool StyleRef::operator==(const StyleRef& other) const {
+    return styleId == other.styleId;
+}
+
+bool StyleRef::operator!=(const StyleRef& other) const {
+    return styleId != other.styleId;
+}
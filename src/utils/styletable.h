@@ -0,0 +1,92 @@
+#ifndef STYLETABLE_H
+#define STYLETABLE_H
+
+#include <QtGui>
+
+// Shared table of label styles
+// A dataset has a few distinct tags and colors shared by many labels,
+// so labels only keep a reference to their style. Equal styles get the same ID
+// while referenced, so IDs can be compared directly.
+// Styles are counted by StyleRef and released with their last reference.
+// Referenced styles are read without locking from any thread.
+// When the table is full, new styles get an invalid ID instead, and label files refuse to
+// read or write labels with it so that no label silently loses its tag and color.
+
+class StyleTable {
+public:
+    struct Style {
+        QString tag;
+        QPen pen;
+        QBrush brush;
+    };
+
+public:
+    // The ID must be referenced, 0 is the empty style and Invalid reads as it
+    static const Style& get(int id);
+
+    static const int Invalid = -1;
+
+    // Number of referenced styles
+    static int count();
+
+private:
+    friend class StyleRef;
+
+    struct Entry {
+        Style style;
+        QAtomicInt refs;
+        uint key = 0;
+        bool alive = false;
+    };
+
+    StyleTable();
+    static StyleTable* instance();
+
+    // Return the ID of an equal style with a reference added, adding it if there's none
+    // Return Invalid if the table is full
+    static int intern(const QString& tag, const QPen& pen, const QBrush& brush);
+    static void ref(int id);
+    static void release(int id);
+
+    Entry& entry(int id);
+    static uint hash(const QString& tag, const QPen& pen, const QBrush& brush);
+
+    // Entries are stored in chunks that never move so that readers need no lock
+    static const int ChunkBits = 8;
+    static const int ChunkSize = 1 << ChunkBits;
+    static const int MaxChunks = 1 << 12;
+
+private:
+    QMutex mutex;
+    QMultiHash<uint, int> ids;
+    QAtomicPointer<Entry> chunks[MaxChunks];
+
+    // Entries below are used or free
+    int size = 1;
+    QVector<int> freeIds;
+};
+
+// Counted reference to a style in the table
+
+class StyleRef {
+public:
+    StyleRef();
+    StyleRef(const QString& tag, const QPen& pen, const QBrush& brush);
+    StyleRef(const StyleRef& other);
+    StyleRef& operator=(const StyleRef& other);
+    ~StyleRef();
+
+    int id() const;
+    const StyleTable::Style& get() const;
+
+    // False if the table was full
+    bool isValid() const;
+
+    bool operator==(const StyleRef& other) const;
+    bool operator!=(const StyleRef& other) const;
+
+private:
+    int styleId;
+};
+
+#endif // STYLETABLE_H
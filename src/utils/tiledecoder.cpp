@@ -0,0 +1,169 @@
+#include "tiledecoder.h"
+
+const int TileDecoder::TileSize;
+const int TileDecoder::PreviewSize;
+const qint64 TileDecoder::MinPixels;
+const qint64 TileDecoder::MaxWholeBytes;
+
+TileDecoder::TileDecoder(QObject* parent) :
+    QObject(parent),
+    cache(256*1024)
+{
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+}
+
+TileDecoder::~TileDecoder() {
+    generation.fetchAndAddOrdered(1);
+    pool.clear();
+    pool.waitForDone();
+}
+
+bool TileDecoder::prefersTiles(const QString& fileName) {
+    QImageReader reader(fileName);
+    if (!reader.supportsOption(QImageIOHandler::ClipRect))
+        return false;
+    // Clip rects are in the stored orientation
+    if (reader.transformation() != QImageIOHandler::TransformationNone)
+        return false;
+    QSize size = reader.size();
+    return qint64(size.width())*size.height() >= MinPixels;
+}
+
+QSize TileDecoder::imageSize(const QString& fileName) {
+    return QImageReader(fileName).size();
+}
+
+QImage TileDecoder::tile(const QString& fileName, int level, int x, int y) {
+    QImage* img = cache.object(tileKey(fileName, level, x, y));
+    return img ? *img : QImage();
+}
+
+void TileDecoder::request(const QString& fileName, int level, int top, int bottom) {
+    if (failedFiles.contains(fileName))
+        return;
+    if (!sizes.contains(fileName))
+        sizes.insert(fileName, imageSize(fileName));
+    QSize size = sizes.value(fileName);
+    if (qint64(size.width() >> level)*(size.height() >> level)*4 <= MaxWholeBytes) {
+        QString key = QString("whole/%1/%2").arg(level).arg(fileName);
+        if (!pending.contains(key)) {
+            schedule(fileName, {key}, [fileName, size, level] () {
+                return decodeRows(fileName, size, level, 0, size.height());
+            });
+        }
+        return;
+    }
+    // Rows already being decoded are trimmed from the ends
+    auto rowKey = [&] (int y) {
+        return QString("band/%1/%2/%3").arg(level).arg(y).arg(fileName);
+    };
+    while (top <= bottom && pending.contains(rowKey(top)))
+        ++top;
+    while (bottom >= top && pending.contains(rowKey(bottom)))
+        --bottom;
+    if (top > bottom)
+        return;
+    QStringList keys;
+    for (int y = top; y <= bottom; ++y)
+        keys << rowKey(y);
+    int span = TileSize << level;
+    int first = top*span;
+    int last = qMin((bottom + 1)*span, size.height());
+    schedule(fileName, keys, [fileName, size, level, first, last] () {
+        return decodeRows(fileName, size, level, first, last);
+    });
+}
+
+QImage TileDecoder::preview(const QString& fileName) {
+    QString key = "preview/"+fileName;
+    if (QImage* img = cache.object(key))
+        return *img;
+    if (failedFiles.contains(fileName) || pending.contains(key))
+        return QImage();
+    schedule(fileName, {key}, [fileName] () {
+        return decodePreview(fileName);
+    });
+    return QImage();
+}
+
+void TileDecoder::cancel() {
+    generation.fetchAndAddOrdered(1);
+    pool.clear();
+    pending.clear();
+    failedFiles.clear();
+}
+
+void TileDecoder::setMemoryBudget(qint64 bytes) {
+    cache.setMaxCost(int(qMin<qint64>(bytes >> 10, INT_MAX)));
+}
+
+void TileDecoder::schedule(const QString& fileName, const QStringList& keys, const std::function<Result()>& decode) {
+    for (const QString& key: keys)
+        pending.insert(key);
+    int gen = generation.load();
+    QtConcurrent::run(&pool, [this, fileName, keys, decode, gen] () {
+        if (generation.load() != gen)
+            return;
+        Result result = decode();
+        QMetaObject::invokeMethod(this, [this, fileName, keys, result, gen] () {
+            if (generation.load() != gen)
+                return;
+            for (const QString& key: keys)
+                pending.remove(key);
+            if (!result.error.isNull()) {
+                // Retrying would fail the same way on every paint
+                if (!failedFiles.contains(fileName)) {
+                    failedFiles.insert(fileName);
+                    emit failed(fileName, result.error);
+                }
+                return;
+            }
+            for (const auto& pair: result.images)
+                cache.insert(pair.first, new QImage(pair.second), int(pair.second.sizeInBytes() >> 10) + 1);
+            emit tileReady(fileName);
+        }, Qt::QueuedConnection);
+    });
+}
+
+QString TileDecoder::tileKey(const QString& fileName, int level, int x, int y) {
+    return QString("%1/%2/%3/%4").arg(level).arg(x).arg(y).arg(fileName);
+}
+
+TileDecoder::Result TileDecoder::decodeRows(const QString& fileName, const QSize& size, int level, int top, int bottom) {
+    Result result;
+    QImageReader reader(fileName);
+    QRect clip(0, top, size.width(), bottom - top);
+    int round = (1 << level) - 1;
+    reader.setClipRect(clip);
+    // JPEG scales while decoding so coarse levels are cheap
+    reader.setScaledSize(QSize((clip.width() + round) >> level, (clip.height() + round) >> level));
+    QImage rows = toDisplayFormat(reader.read());
+    if (rows.isNull()) {
+        result.error = reader.errorString();
+        return result;
+    }
+    int y0 = (top >> level)/TileSize;
+    for (int y = 0; y < rows.height(); y += TileSize)
+        for (int x = 0; x < rows.width(); x += TileSize)
+            result.images << qMakePair(tileKey(fileName, level, x/TileSize, y0 + y/TileSize), rows.copy(x, y, qMin(TileSize, rows.width() - x), qMin(TileSize, rows.height() - y)));
+    return result;
+}
+
+TileDecoder::Result TileDecoder::decodePreview(const QString& fileName) {
+    Result result;
+    QImageReader reader(fileName);
+    reader.setScaledSize(reader.size().scaled(PreviewSize, PreviewSize, Qt::KeepAspectRatio));
+    QImage img = toDisplayFormat(reader.read());
+    if (img.isNull())
+        result.error = reader.errorString();
+    else
+        result.images << qMakePair("preview/"+fileName, img);
+    return result;
+}
+
+QImage TileDecoder::toDisplayFormat(const QImage& img) {
+    if (img.isNull())
+        return img;
+    QImage::Format format = img.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+    return img.format() == format ? img : img.convertToFormat(format);
+}
@@ -0,0 +1,95 @@
+#ifndef TILEDECODER_H
+#define TILEDECODER_H
+
+#include <QtGui>
+#include <QtConcurrent>
+
+// Decode parts of large images on worker threads
+// Only files whose format can decode a clip rect without reading the whole image are decoded by tiles,
+// which in practice means JPEG; other files are still decoded whole.
+// A small preview is decoded first so that something is shown at once, then tiles replace it.
+// JPEG decodes every row above a clip rect, so all the rows of tiles requested together are decoded
+// in one pass and cut into tiles, and coarse levels small enough are decoded whole.
+// Decoded tiles are kept in a cache within a memory budget, shared by all windows.
+
+class TileDecoder : public QObject {
+    Q_OBJECT
+
+public:
+    explicit TileDecoder(QObject* parent = nullptr);
+    ~TileDecoder();
+
+    // Whether a file should be decoded by tiles instead of whole
+    // Safe to call from any thread
+    static bool prefersTiles(const QString& fileName);
+
+    // Read from the header only
+    static QSize imageSize(const QString& fileName);
+
+    // Tile (x, y) of the image scaled by 2^-level, each covering TileSize << level pixels of the image
+    // Return a null image if not decoded yet
+    QImage tile(const QString& fileName, int level, int x, int y);
+
+    // Decode rows [top, bottom] of tiles of a level in the background, except those already being decoded
+    // Request all the missing rows in view at once since rows decoded separately each decode the rows above them
+    void request(const QString& fileName, int level, int top, int bottom);
+
+    // The whole image scaled to fit in PreviewSize
+    QImage preview(const QString& fileName);
+
+    // Drop requests not started yet, e.g. after another file is opened
+    void cancel();
+
+    void setMemoryBudget(qint64 bytes);
+
+    static const int TileSize = 256;
+    static const int PreviewSize = 1024;
+
+    // Images with fewer pixels are decoded whole
+    static const qint64 MinPixels = 4096*4096;
+
+    // Levels whose scaled image takes fewer bytes are decoded whole
+    static const qint64 MaxWholeBytes = 64 << 20;
+
+signals:
+    void tileReady(const QString& fileName);
+
+    // Emitted once per file, its tiles are not requested again until cancel()
+    void failed(const QString& fileName, const QString& error);
+
+private:
+    // Decoded images with their cache keys, or an error
+    struct Result {
+        QList<QPair<QString, QImage>> images;
+        QString error;
+    };
+
+    // Keys are marked pending until the decoding finishes
+    void schedule(const QString& fileName, const QStringList& keys, const std::function<Result()>& decode);
+
+    static QString tileKey(const QString& fileName, int level, int x, int y);
+
+    // Decode rows [top, bottom) of the image scaled by 2^-level and cut them into tiles
+    static Result decodeRows(const QString& fileName, const QSize& size, int level, int top, int bottom);
+    static Result decodePreview(const QString& fileName);
+
+    // Same formats as ImageCache so that conversion to pixmaps is cheap
+    static QImage toDisplayFormat(const QImage& img);
+
+private:
+    QThreadPool pool;
+
+    // Keys of rows of tiles, whole levels and previews being decoded
+    QSet<QString> pending;
+
+    QHash<QString, QSize> sizes;
+    QSet<QString> failedFiles;
+
+    // Increased by cancel() so that outdated requests are skipped
+    QAtomicInt generation;
+
+    // Cost in KiB
+    QCache<QString, QImage> cache;
+};
+
+#endif // TILEDECODER_H
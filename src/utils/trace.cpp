@@ -0,0 +1,105 @@
+#include "trace.h"
+
+namespace {
+
+// Innermost input handled on the thread
+thread_local Trace::Input* currentInput = nullptr;
+
+}
+
+const int Trace::Capacity;
+
+Trace::Scope::Scope(const char* name, const void* widget) :
+    name(name),
+    widget(widget),
+    start(Trace::instance()->clock.nsecsElapsed())
+{
+}
+
+Trace::Scope::~Scope() {
+    Trace* trace = Trace::instance();
+    qint64 end = trace->clock.nsecsElapsed();
+    qint64 input = -1;
+    // A frame serves all inputs of its widget before it
+    if (widget) {
+        QMutexLocker locker(&trace->mutex);
+        input = trace->inputs.value(widget, -1);
+        trace->inputs.remove(widget);
+    }
+    trace->record({name, threadIndex(), start, end - start, input >= 0 ? end - input : -1, widget != nullptr});
+}
+
+Trace::Input::Input() :
+    start(Trace::instance()->clock.nsecsElapsed()),
+    outer(currentInput)
+{
+    currentInput = this;
+}
+
+Trace::Input::~Input() {
+    currentInput = outer;
+}
+
+Trace::Trace() :
+    buffer(Capacity)
+{
+    clock.start();
+}
+
+Trace* Trace::instance() {
+    static Trace trace;
+    return &trace;
+}
+
+void Trace::markUpdate(const void* widget) {
+    if (!currentInput)
+        return;
+    QMutexLocker locker(&mutex);
+    // Keep the oldest input
+    if (!inputs.contains(widget))
+        inputs.insert(widget, currentInput->start);
+}
+
+QVector<Trace::Event> Trace::events() const {
+    QMutexLocker locker(&mutex);
+    if (!wrapped)
+        return buffer.mid(0, next);
+    return buffer.mid(next) + buffer.mid(0, next);
+}
+
+bool Trace::writeChromeTrace(const QString& fileName) const {
+    QJsonArray array;
+    for (const Event& event: events()) {
+        QJsonObject object{
+            {"name", event.name},
+            {"ph", "X"},
+            {"pid", 1},
+            {"tid", event.thread},
+            {"ts", event.start/1e3},
+            {"dur", event.duration/1e3}
+        };
+        if (event.latency >= 0)
+            object.insert("args", QJsonObject{{"latency_ms", event.latency/1e6}});
+        array.append(object);
+    }
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(QJsonDocument(QJsonObject{{"traceEvents", array}, {"displayTimeUnit", "ms"}}).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
+
+void Trace::record(const Event& event) {
+    QMutexLocker locker(&mutex);
+    buffer[next] = event;
+    if (++next == Capacity) {
+        next = 0;
+        wrapped = true;
+    }
+}
+
+int Trace::threadIndex() {
+    static QAtomicInt count;
+    static thread_local int index = count.fetchAndAddRelaxed(1);
+    return index;
+}
@@ -0,0 +1,99 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QtCore>
+
+// Record how long interactive paths take
+// Scopes are recorded into a ring buffer that can be saved as a Chrome trace (chrome://tracing)
+// or drawn by TraceOverlay.
+// An input handler that requests a repaint of a widget marks the input as pending for that widget,
+// and the next frame of the widget records the time since its oldest pending input as the
+// input-to-paint latency. Inputs that don't repaint anything are never counted.
+// Build with CONFIG+=notrace to remove all of it at compile time.
+
+#ifdef LABELING_TRACE
+#define TRACE_SCOPE(name) Trace::Scope traceScope(name)
+#define TRACE_FRAME(name) Trace::Scope traceScope(name, this)
+#define TRACE_INPUT() Trace::Input traceInput
+#define TRACE_UPDATE() Trace::instance()->markUpdate(this)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_FRAME(name)
+#define TRACE_INPUT()
+#define TRACE_UPDATE()
+#endif
+
+class Trace {
+public:
+    struct Event {
+        // Names are string literals so that recording does not allocate
+        const char* name;
+        int thread;
+
+        // In nanoseconds since the trace started
+        qint64 start;
+        qint64 duration;
+
+        // From the oldest input of the widget not painted yet to the end of the frame, -1 if none
+        qint64 latency;
+
+        // Whether the event paints a frame
+        bool frame;
+    };
+
+    class Scope {
+    public:
+        // A scope with a widget paints a frame of it
+        Scope(const char* name, const void* widget = nullptr);
+        ~Scope();
+
+    private:
+        const char* name;
+        const void* widget;
+        qint64 start;
+    };
+
+    // Lives while an input event is handled
+    class Input {
+    public:
+        Input();
+        ~Input();
+
+    private:
+        friend class Trace;
+        qint64 start;
+        Input* outer;
+    };
+
+public:
+    static Trace* instance();
+
+    // Called when a widget is about to be repainted, marks the input being handled if any
+    void markUpdate(const void* widget);
+
+    // Events in the buffer from the oldest
+    QVector<Event> events() const;
+
+    bool writeChromeTrace(const QString& fileName) const;
+
+    static const int Capacity = 1 << 16;
+
+private:
+    Trace();
+    void record(const Event& event);
+    static int threadIndex();
+
+private:
+    QElapsedTimer clock;
+
+    mutable QMutex mutex;
+
+    // Time of the oldest input not painted yet for each widget
+    QHash<const void*, qint64> inputs;
+
+    QVector<Event> buffer;
+    int next = 0;
+    bool wrapped = false;
+};
+
+#endif // TRACE_H
@@ -0,0 +1,120 @@
+#include "undostack.h"
+
+int UndoStack::Edit::type() const {
+    if (removed.empty())
+        return Insert;
+    if (inserted.empty())
+        return Remove;
+    return Modify;
+}
+
+qint64 UndoStack::Edit::cost() const {
+    qint64 sum = sizeof(Edit);
+    for (const Label& label: removed)
+        sum += UndoStack::cost(label);
+    for (const Label& label: inserted)
+        sum += UndoStack::cost(label);
+    return sum;
+}
+
+void UndoStack::clear() {
+    current.clear();
+    based = false;
+    edits.clear();
+    pos = 0;
+    usage = 0;
+}
+
+void UndoStack::record(const QList<Label>& labels) {
+    if (!based) {
+        current = labels;
+        based = true;
+        return;
+    }
+    Edit edit = diff(current, labels);
+    current = labels;
+    if (edit.removed.empty() && edit.inserted.empty())
+        return;
+
+    // Edits after the current position can no longer be redone
+    while (edits.size() > pos)
+        usage -= edits.takeLast().cost();
+
+    if (!merge(edit)) {
+        edits << edit;
+        usage += edit.cost();
+        ++pos;
+    }
+    trim();
+}
+
+bool UndoStack::canUndo() const {
+    return pos > 0;
+}
+
+bool UndoStack::canRedo() const {
+    return pos < edits.size();
+}
+
+const QList<Label>& UndoStack::undo() {
+    apply(current, edits[--pos], true);
+    return current;
+}
+
+const QList<Label>& UndoStack::redo() {
+    apply(current, edits[pos++]);
+    return current;
+}
+
+void UndoStack::setMemoryBudget(qint64 bytes) {
+    budget = bytes;
+    trim();
+}
+
+UndoStack::Edit UndoStack::diff(const QList<Label>& from, const QList<Label>& to) {
+    int n = from.size();
+    int m = to.size();
+    int prefix = 0;
+    while (prefix < n && prefix < m && from[prefix] == to[prefix])
+        ++prefix;
+    int suffix = 0;
+    while (suffix < n - prefix && suffix < m - prefix && from[n - 1 - suffix] == to[m - 1 - suffix])
+        ++suffix;
+    return {prefix, from.mid(prefix, n - prefix - suffix), to.mid(prefix, m - prefix - suffix)};
+}
+
+void UndoStack::apply(QList<Label>& labels, const Edit& edit, bool reverse) {
+    const QList<Label>& removed = reverse ? edit.inserted : edit.removed;
+    const QList<Label>& inserted = reverse ? edit.removed : edit.inserted;
+    labels = labels.mid(0, edit.index) + inserted + labels.mid(edit.index + removed.size());
+}
+
+// Styles are shared in the style table so they are not counted
+qint64 UndoStack::cost(const Label& label) {
+    return sizeof(Label)
+        + label.path.elementCount()*sizeof(QPainterPath::Element)
+        + label.mask.byteCount();
+}
+
+bool UndoStack::merge(const Edit& edit) {
+    if (pos == 0 || edit.type() != Edit::Modify)
+        return false;
+    Edit& last = edits[pos - 1];
+    if (last.type() != Edit::Modify || last.index != edit.index || last.inserted.size() != edit.removed.size())
+        return false;
+    usage -= last.cost();
+    last.inserted = edit.inserted;
+    if (last.removed == last.inserted) {
+        edits.removeAt(--pos);
+        return true;
+    }
+    usage += last.cost();
+    return true;
+}
+
+void UndoStack::trim() {
+    while (usage > budget && pos > 1) {
+        usage -= edits.takeFirst().cost();
+        --pos;
+    }
+}
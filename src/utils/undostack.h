@@ -0,0 +1,70 @@
+#ifndef UNDOSTACK_H
+#define UNDOSTACK_H
+
+#include <QtGui>
+#include "label.h"
+
+// Undo history of a label list
+// Each edit only keeps the labels it replaced instead of the whole list
+// The oldest edits are dropped when the history exceeds the memory budget
+
+class UndoStack {
+public:
+    // Replacement of a range of the list
+    struct Edit {
+        enum Type {Insert, Remove, Modify};
+
+        int type() const;
+        qint64 cost() const;
+
+        int index;
+        QList<Label> removed;
+        QList<Label> inserted;
+    };
+
+public:
+    // The next recorded list becomes the base of the history
+    void clear();
+
+    // Record the difference between the last list and the given one
+    void record(const QList<Label>& labels);
+
+    bool canUndo() const;
+    bool canRedo() const;
+
+    // Return the list after undoing or redoing
+    const QList<Label>& undo();
+    const QList<Label>& redo();
+
+    void setMemoryBudget(qint64 bytes);
+
+    // Common prefix and suffix are excluded from the edit
+    static Edit diff(const QList<Label>& from, const QList<Label>& to);
+
+    // Apply an edit in reverse to undo it
+    static void apply(QList<Label>& labels, const Edit& edit, bool reverse = false);
+
+    // Rough estimate of the memory held by a label
+    static qint64 cost(const Label& label);
+
+private:
+    // Merge an edit into the last one if both modify the same labels
+    bool merge(const Edit& edit);
+
+    // Drop the oldest edits until the budget is met
+    void trim();
+
+private:
+    QList<Label> current;
+    bool based = false;
+
+    QList<Edit> edits;
+
+    // Number of edits applied to the base list
+    int pos = 0;
+
+    qint64 usage = 0;
+    qint64 budget = 64 << 20;
+};
+
+#endif // UNDOSTACK_H
@@ -8,11 +8,33 @@ inline QColor randomColor(int alpha = 0xFF) {
     return QColor(qRed(rgb), qGreen(rgb), qBlue(rgb), alpha);
 }
 
+// Supported formats are only queried once since it loads every image plugin
 inline QStringList imageFilters() {
-    QStringList filters;
-    for(const QByteArray& format: QImageReader::supportedImageFormats())
-        filters << "*."+format;
+    static const QStringList filters = [] () {
+        QStringList filters;
+        for(const QByteArray& format: QImageReader::supportedImageFormats())
+            filters << "*."+format;
+        return filters;
+    }();
     return filters;
 }
 
+// Scale up a 32-bit image by an integer factor without interpolation
+// The destination is reused if it already has the right size
+inline void zoomNearest(const QImage& src, QImage* dst, int factor) {
+    Q_ASSERT(src.depth() == 32);
+    QSize size = src.size()*factor;
+    if (dst->size() != size || dst->format() != src.format())
+        *dst = QImage(size, src.format());
+    for (int y = 0; y < src.height(); ++y) {
+        const QRgb* in = reinterpret_cast<const QRgb*>(src.constScanLine(y));
+        QRgb* out = reinterpret_cast<QRgb*>(dst->scanLine(y*factor));
+        for (int x = 0; x < src.width(); ++x)
+            for (int i = 0; i < factor; ++i)
+                *out++ = in[x];
+        for (int i = 1; i < factor; ++i)
+            memcpy(dst->scanLine(y*factor + i), dst->constScanLine(y*factor), dst->bytesPerLine());
+    }
+}
+
 #endif // UTIL_H
@@ -0,0 +1,448 @@
+#include "volume.h"
+#include "util.h"
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VOLUME_SSE2
+#endif
+
+namespace {
+
+// Slice kernels
+// Rows along x are contiguous within a brick while rows along y have a stride of a brick row
+
+template <typename T>
+inline void gatherRow(T* dst, const T* src, int stride, int n) {
+    for (int x = 0; x < n; ++x, src += stride)
+        dst[x] = *src;
+}
+
+// Window kernels
+// 8-bit values go through a table while 16-bit values are scaled 8 at a time
+
+inline void lookupRow(QRgb* dst, const quint8* src, const QRgb* lut, int n) {
+    for (int x = 0; x < n; ++x)
+        dst[x] = lut[src[x]];
+}
+
+inline void windowRow(QRgb* dst, const quint16* src, int low, float scale, int n) {
+    int x = 0;
+#ifdef VOLUME_SSE2
+    __m128i zero = _mm_setzero_si128();
+    __m128i offset = _mm_set1_epi32(low);
+    __m128 factor = _mm_set1_ps(scale);
+    __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+    for (; x + 8 <= n; x += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+        __m128i a = _mm_sub_epi32(_mm_unpacklo_epi16(v, zero), offset);
+        __m128i b = _mm_sub_epi32(_mm_unpackhi_epi16(v, zero), offset);
+        a = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(a), factor));
+        b = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(b), factor));
+        // Saturate to bytes, then repeat each byte in all channels
+        __m128i g = _mm_packus_epi16(_mm_packs_epi32(a, b), zero);
+        g = _mm_unpacklo_epi8(g, g);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_or_si128(_mm_unpacklo_epi16(g, g), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x + 4), _mm_or_si128(_mm_unpackhi_epi16(g, g), alpha));
+    }
+#endif
+    for (; x < n; ++x) {
+        int g = qBound(0, qRound((src[x] - low)*scale), 255);
+        dst[x] = qRgb(g, g, g);
+    }
+}
+
+// Range of values in a grayscale image
+template <typename T>
+void valueRange(const QImage& img, int* minValue, int* maxValue) {
+    for (int y = 0; y < img.height(); ++y) {
+        const T* line = reinterpret_cast<const T*>(img.constScanLine(y));
+        for (int x = 0; x < img.width(); ++x) {
+            *minValue = qMin<int>(*minValue, line[x]);
+            *maxValue = qMax<int>(*maxValue, line[x]);
+        }
+    }
+}
+
+}
+
+const int Volume::HeaderSize;
+const qint64 Volume::MaxCacheSize;
+const int Volume::BrickSize;
+
+bool Volume::isNull() const {
+    return !voxels;
+}
+
+int Volume::width() const {
+    return w;
+}
+
+int Volume::height() const {
+    return h;
+}
+
+int Volume::depth() const {
+    return d;
+}
+
+int Volume::format() const {
+    return fmt;
+}
+
+int Volume::minValue() const {
+    return minimum;
+}
+
+int Volume::maxValue() const {
+    return maximum;
+}
+
+void Volume::setWindow(int level, int width) {
+    this->level = level;
+    window = qMax(1, width);
+    if (fmt != Gray8)
+        return;
+    lut.resize(256);
+    float scale = 255.0f/window;
+    int low = level - window/2;
+    for (int v = 0; v < 256; ++v) {
+        int g = qBound(0, qRound((v - low)*scale), 255);
+        lut[v] = qRgb(g, g, g);
+    }
+}
+
+int Volume::windowLevel() const {
+    return level;
+}
+
+int Volume::windowWidth() const {
+    return window;
+}
+
+bool Volume::load(const QString& dirName, QString* error, const Waiter& wait) {
+    error->clear();
+    QDir dir(dirName);
+    QStringList filePaths;
+    for (const QString& fileName: dir.entryList(imageFilters()))
+        filePaths << dir.filePath(fileName);
+    if (filePaths.empty())
+        return false;
+    QString cacheName = cacheFileName(dirName, filePaths);
+    if (open(cacheName))
+        return true;
+    return build(filePaths, cacheName, error, wait) && open(cacheName);
+}
+
+void Volume::close() {
+    file.reset();
+    voxels = nullptr;
+    setSize(0, 0, 0);
+}
+
+QString Volume::fileName() const {
+    return file ? file->fileName() : QString();
+}
+
+// Grayscale rows are extracted into a buffer first and then mapped into the image
+// RGB rows are extracted into the image directly
+
+void Volume::top(int k, QImage* img) const {
+    reserve(img, w, h);
+    QByteArray buffer(w*bytesPerVoxel, Qt::Uninitialized);
+    for (int i = 0; i < h; ++i) {
+        QRgb* line = reinterpret_cast<QRgb*>(img->scanLine(i));
+        uchar* row = fmt == Rgb32 ? reinterpret_cast<uchar*>(line) : reinterpret_cast<uchar*>(buffer.data());
+        for (int j = 0; j < w; j += BrickSize)
+            memcpy(row + j*bytesPerVoxel, voxelAt(i, j, k), qMin(BrickSize, w - j)*bytesPerVoxel);
+        mapRow(line, row, w);
+    }
+}
+
+void Volume::left(int j, QImage* img) const {
+    reserve(img, h, d);
+    QByteArray buffer(h*bytesPerVoxel, Qt::Uninitialized);
+    for (int k = 0; k < d; ++k) {
+        QRgb* line = reinterpret_cast<QRgb*>(img->scanLine(k));
+        uchar* row = fmt == Rgb32 ? reinterpret_cast<uchar*>(line) : reinterpret_cast<uchar*>(buffer.data());
+        for (int i = 0; i < h; i += BrickSize)
+            gather(row + i*bytesPerVoxel, voxelAt(i, j, k), BrickSize, qMin(BrickSize, h - i));
+        mapRow(line, row, h);
+    }
+}
+
+void Volume::front(int i, QImage* img) const {
+    reserve(img, w, d);
+    QByteArray buffer(w*bytesPerVoxel, Qt::Uninitialized);
+    for (int k = 0; k < d; ++k) {
+        QRgb* line = reinterpret_cast<QRgb*>(img->scanLine(k));
+        uchar* row = fmt == Rgb32 ? reinterpret_cast<uchar*>(line) : reinterpret_cast<uchar*>(buffer.data());
+        for (int j = 0; j < w; j += BrickSize)
+            memcpy(row + j*bytesPerVoxel, voxelAt(i, j, k), qMin(BrickSize, w - j)*bytesPerVoxel);
+        mapRow(line, row, w);
+    }
+}
+
+QString Volume::cacheFileName(const QString& dirName, const QStringList& filePaths) {
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QFileInfo(dirName).absoluteFilePath().toUtf8());
+    for (const QString& filePath: filePaths) {
+        QFileInfo info(filePath);
+        hash.addData(info.fileName().toUtf8());
+        hash.addData(QByteArray::number(info.size()));
+        hash.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+    }
+    QDir dir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+    return dir.filePath("volumes/"+QString::fromLatin1(hash.result().toHex())+".vol");
+}
+
+bool Volume::build(const QStringList& filePaths, const QString& cacheName, QString* error, const Waiter& wait) {
+    QVector<int> slices(filePaths.size());
+    std::iota(slices.begin(), slices.end(), 0);
+
+    // Check sizes from headers before decoding anything
+    // Headers of a large stack take a while to read too, so they're read on the pool
+    QVector<QSize> sizes(filePaths.size());
+    QVector<QImage::Format> formats(filePaths.size());
+    QVector<QString> messages(filePaths.size());
+    QFuture<void> headers = QtConcurrent::map(slices, [&] (int k) {
+        sizes[k] = imageSize(filePaths[k], &messages[k]);
+        formats[k] = QImageReader(filePaths[k]).imageFormat();
+    });
+    if (wait)
+        wait(headers);
+    headers.waitForFinished();
+    if (headers.isCanceled())
+        return false;
+    QSize size = sizes.first();
+    for (int k = 0; k < filePaths.size(); ++k) {
+        if (!sizes[k].isValid()) {
+            *error = messages[k];
+            return false;
+        }
+        if (sizes[k] != size) {
+            *error = QString("Cannot load %1: the size is %2x%3 but %4x%5 is expected from %6")
+                .arg(QDir::toNativeSeparators(filePaths[k])).arg(sizes[k].width()).arg(sizes[k].height())
+                .arg(size.width()).arg(size.height()).arg(QDir::toNativeSeparators(filePaths.first()));
+            return false;
+        }
+    }
+    Volume layout;
+    layout.setSize(size.width(), size.height(), filePaths.size());
+    int format = storageFormat(formats);
+    int bytes = voxelSize(format);
+
+    // Write a temporary file in place through a mapping
+    QDir().mkpath(QFileInfo(cacheName).path());
+    QFile out(cacheName+".part");
+    if (!out.open(QIODevice::ReadWrite | QIODevice::Truncate) || !out.resize(HeaderSize + layout.voxelCount()*bytes)) {
+        *error = QString("Cannot write %1: %2").arg(QDir::toNativeSeparators(cacheName), out.errorString());
+        out.remove();
+        return false;
+    }
+    uchar* data = out.map(0, out.size());
+    if (!data) {
+        *error = QString("Cannot write %1: %2").arg(QDir::toNativeSeparators(cacheName), out.errorString());
+        out.remove();
+        return false;
+    }
+    layout.bytesPerVoxel = bytes;
+    uchar* voxels = data + HeaderSize;
+    int rangeMin = format == Gray16 ? 0xFFFF : 0xFF;
+    int rangeMax = 0;
+
+    // Slices are decoded in parallel directly into their bricks
+    // Remaining slices are skipped once one of them fails
+    QMutex mutex;
+    QAtomicInt failed;
+    QFuture<void> future = QtConcurrent::map(slices, [&] (int k) {
+        if (failed.loadAcquire())
+            return;
+        QString message;
+        QImage img = decode(filePaths[k], format, &message);
+        // The header may not match the decoded image
+        if (!img.isNull() && img.size() != size)
+            message = QString("Cannot load %1: the size is %2x%3 but %4x%5 is expected")
+                .arg(QDir::toNativeSeparators(filePaths[k])).arg(img.width()).arg(img.height()).arg(size.width()).arg(size.height());
+        if (img.size() != size) {
+            QMutexLocker locker(&mutex);
+            if (!failed.fetchAndStoreOrdered(1))
+                *error = message;
+            return;
+        }
+        for (int i = 0; i < layout.h; ++i)
+            layout.writeRow(voxels, i, k, img.constScanLine(i));
+        if (format == Rgb32)
+            return;
+        int low = INT_MAX;
+        int high = 0;
+        if (format == Gray16)
+            valueRange<quint16>(img, &low, &high);
+        else
+            valueRange<quint8>(img, &low, &high);
+        QMutexLocker locker(&mutex);
+        rangeMin = qMin(rangeMin, low);
+        rangeMax = qMax(rangeMax, high);
+    });
+    if (wait)
+        wait(future);
+    future.waitForFinished();
+
+    if (format == Rgb32) {
+        rangeMin = 0;
+        rangeMax = 0xFF;
+    }
+    *reinterpret_cast<Header*>(data) = {Magic, Version, quint32(layout.w), quint32(layout.h), quint32(layout.d), quint32(BrickSize),
+                                        quint32(format), quint32(rangeMin), quint32(rangeMax)};
+    out.unmap(data);
+    out.close();
+    if (failed.loadAcquire() || future.isCanceled()) {
+        out.remove();
+        return false;
+    }
+    QFile::remove(cacheName);
+    if (!out.rename(cacheName)) {
+        *error = QString("Cannot write %1: %2").arg(QDir::toNativeSeparators(cacheName), out.errorString());
+        out.remove();
+        return false;
+    }
+    evict(cacheName);
+    return true;
+}
+
+QSize Volume::imageSize(const QString& filePath, QString* error) {
+    QImageReader reader(filePath);
+    reader.setAutoTransform(true);
+    QSize size = reader.size();
+    if (size.isValid()) {
+        if (reader.transformation() & QImageIOHandler::TransformationRotate90)
+            size.transpose();
+        return size;
+    }
+    // Some formats only know the size after decoding
+    return decode(filePath, Rgb32, error).size();
+}
+
+int Volume::storageFormat(const QVector<QImage::Format>& formats) {
+    int format = Gray8;
+    for (QImage::Format imageFormat: formats) {
+        if (imageFormat == QImage::Format_Grayscale16)
+            format = Gray16;
+        else if (imageFormat != QImage::Format_Grayscale8)
+            return Rgb32;
+    }
+    return format;
+}
+
+QImage Volume::decode(const QString& filePath, int format, QString* error) {
+    QImageReader reader(filePath);
+    reader.setAutoTransform(true);
+    QImage img = reader.read();
+    if (img.isNull()) {
+        *error = QString("Cannot load %1: %2").arg(QDir::toNativeSeparators(filePath), reader.errorString());
+        return img;
+    }
+    if (format == Gray8 && img.format() != QImage::Format_Grayscale8)
+        img = img.convertToFormat(QImage::Format_Grayscale8);
+    else if (format == Gray16 && img.format() != QImage::Format_Grayscale16)
+        img = img.convertToFormat(QImage::Format_Grayscale16);
+    else if (format == Rgb32 && !QSet<QImage::Format>{QImage::Format_RGB32, QImage::Format_ARGB32}.contains(img.format()))
+        img = img.convertToFormat(QImage::Format_ARGB32);
+    return img;
+}
+
+bool Volume::open(const QString& cacheName) {
+    QScopedPointer<QFile> mapped(new QFile(cacheName));
+    if (!mapped->open(QIODevice::ReadOnly) || mapped->size() < HeaderSize)
+        return false;
+    const uchar* data = mapped->map(0, mapped->size());
+    if (!data)
+        return false;
+    const Header* header = reinterpret_cast<const Header*>(data);
+    if (header->magic != Magic || header->version != Version || header->brickSize != quint32(BrickSize) || header->format > Gray16)
+        return false;
+    Volume layout;
+    layout.setSize(header->width, header->height, header->depth);
+    if (!layout.voxelCount() || mapped->size() != HeaderSize + layout.voxelCount()*voxelSize(header->format))
+        return false;
+    // The modification time tells which caches were used last
+    mapped->setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileModificationTime);
+    file.swap(mapped);
+    voxels = data + HeaderSize;
+    fmt = header->format;
+    bytesPerVoxel = voxelSize(fmt);
+    minimum = header->minValue;
+    maximum = header->maxValue;
+    setSize(layout.w, layout.h, layout.d);
+    setWindow((minimum + maximum + 1)/2, maximum - minimum + 1);
+    return true;
+}
+
+void Volume::evict(const QString& keep) {
+    QDir dir(QFileInfo(keep).path());
+    qint64 total = 0;
+    // Newest first
+    for (const QFileInfo& info: dir.entryInfoList({"*.vol"}, QDir::Files, QDir::Time)) {
+        total += info.size();
+        // Files still mapped by another window fail to be removed on some systems and are kept
+        if (total > MaxCacheSize && info.absoluteFilePath() != QFileInfo(keep).absoluteFilePath())
+            QFile::remove(info.absoluteFilePath());
+    }
+}
+
+void Volume::reserve(QImage* img, int width, int height) {
+    if (img->width() != width || img->height() != height || img->format() != QImage::Format_ARGB32)
+        *img = QImage(width, height, QImage::Format_ARGB32);
+}
+
+void Volume::setSize(int width, int height, int depth) {
+    w = width;
+    h = height;
+    d = depth;
+    bw = (w + BrickSize - 1)/BrickSize;
+    bh = (h + BrickSize - 1)/BrickSize;
+}
+
+int Volume::voxelSize(int format) {
+    return format == Gray8 ? 1 : format == Gray16 ? 2 : 4;
+}
+
+qint64 Volume::voxelCount() const {
+    qint64 bd = (d + BrickSize - 1)/BrickSize;
+    return bd*bh*bw*BrickVoxels;
+}
+
+qint64 Volume::index(int i, int j, int k) const {
+    qint64 brick = (qint64(k/BrickSize)*bh + i/BrickSize)*bw + j/BrickSize;
+    return brick*BrickVoxels + ((k%BrickSize)*BrickSize + i%BrickSize)*BrickSize + j%BrickSize;
+}
+
+const uchar* Volume::voxelAt(int i, int j, int k) const {
+    return voxels + index(i, j, k)*bytesPerVoxel;
+}
+
+void Volume::writeRow(uchar* data, int i, int k, const uchar* line) const {
+    for (int j = 0; j < w; j += BrickSize)
+        memcpy(data + index(i, j, k)*bytesPerVoxel, line + j*bytesPerVoxel, qMin(BrickSize, w - j)*bytesPerVoxel);
+}
+
+void Volume::gather(uchar* dst, const uchar* src, int stride, int n) const {
+    switch (fmt) {
+    case Gray8:
+        gatherRow(dst, src, stride, n);
+        break;
+    case Gray16:
+        gatherRow(reinterpret_cast<quint16*>(dst), reinterpret_cast<const quint16*>(src), stride, n);
+        break;
+    default:
+        gatherRow(reinterpret_cast<QRgb*>(dst), reinterpret_cast<const QRgb*>(src), stride, n);
+        break;
+    }
+}
+
+void Volume::mapRow(QRgb* dst, const uchar* src, int n) const {
+    if (fmt == Gray8)
+        lookupRow(dst, src, lut.constData(), n);
+    else if (fmt == Gray16)
+        windowRow(dst, reinterpret_cast<const quint16*>(src), level - window/2, 255.0f/window, n);
+}
@@ -0,0 +1,143 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#include <QtGui>
+#include <QtConcurrent>
+#include <functional>
+
+// Voxels of a stack of images kept in a memory-mapped cache file
+// Only the pages touched by slice extraction are loaded into memory
+// The cache is reused when the same folder is opened again,
+// and the least recently used caches are removed when they take too much space
+// Grayscale stacks keep their native 8 or 16 bits per voxel
+// and are mapped to colors through a window when slices are extracted
+
+class Volume {
+public:
+    // Called while slices are decoded on the thread pool
+    // The future reports progress and can be cancelled
+    typedef std::function<void(QFuture<void>)> Waiter;
+
+    enum Format {Rgb32, Gray8, Gray16};
+
+public:
+    bool isNull() const;
+    int width() const;
+    int height() const;
+    int depth() const;
+
+    int format() const;
+
+    // Range of gray values in the slices
+    int minValue() const;
+    int maxValue() const;
+
+    // Map gray values in [level - width/2, level + width/2] to black through white
+    // Ignored by RGB volumes
+    // Reset to the range of values when a volume is loaded
+    void setWindow(int level, int width);
+    int windowLevel() const;
+    int windowWidth() const;
+
+    // Keep the current volume if loading fails
+    // The error is empty if loading is cancelled
+    bool load(const QString& dirName, QString* error, const Waiter& wait = Waiter());
+    void close();
+
+    // Cache file of the loaded volume
+    QString fileName() const;
+
+    // Slices perpendicular to z, x and y respectively
+    // The image is reused if it already has the right size
+    void top(int k, QImage* img) const;
+    void left(int j, QImage* img) const;
+    void front(int i, QImage* img) const;
+
+private:
+    struct Header {
+        quint32 magic;
+        quint32 version;
+        quint32 width;
+        quint32 height;
+        quint32 depth;
+        quint32 brickSize;
+        quint32 format;
+        quint32 minValue;
+        quint32 maxValue;
+    };
+
+    // Name of the cache file depends on names, sizes and times of the images
+    static QString cacheFileName(const QString& dirName, const QStringList& filePaths);
+
+    static bool build(const QStringList& filePaths, const QString& cacheName, QString* error, const Waiter& wait);
+
+    // Size read from the header if possible
+    static QSize imageSize(const QString& filePath, QString* error);
+
+    // Format of voxels able to hold images of the formats without loss
+    static int storageFormat(const QVector<QImage::Format>& formats);
+
+    static QImage decode(const QString& filePath, int format, QString* error);
+    bool open(const QString& cacheName);
+
+    // Remove the least recently used cache files beyond the limit except the one kept
+    static void evict(const QString& keep);
+
+    void setSize(int width, int height, int depth);
+    static void reserve(QImage* img, int width, int height);
+    qint64 voxelCount() const;
+    static int voxelSize(int format);
+
+    // Index of voxel (i, j, k)
+    // The next BrickSize - j%BrickSize voxels of the row are contiguous
+    qint64 index(int i, int j, int k) const;
+
+    const uchar* voxelAt(int i, int j, int k) const;
+
+    // Copy a row of a slice into the bricks
+    void writeRow(uchar* data, int i, int k, const uchar* line) const;
+
+    // Copy n voxels that are stride voxels apart
+    void gather(uchar* dst, const uchar* src, int stride, int n) const;
+
+    // Map a row of extracted voxels to colors in place of the window
+    void mapRow(QRgb* dst, const uchar* src, int n) const;
+
+private:
+    static const quint32 Magic = 0x4C425643;
+    static const quint32 Version = 3;
+
+    // Voxels are aligned to pages
+    static const int HeaderSize = 4096;
+
+    // Total size of cache files
+    static const qint64 MaxCacheSize = qint64(4) << 30;
+
+    // Voxels are grouped into cubic bricks so that slices along all axes read nearby memory
+    // A brick of 32-bit voxels takes 16 KiB and one of 8-bit voxels takes a page
+    static const int BrickSize = 16;
+    static const int BrickVoxels = BrickSize*BrickSize*BrickSize;
+
+    QScopedPointer<QFile> file;
+    const uchar* voxels = nullptr;
+    int fmt = Rgb32;
+
+    int bytesPerVoxel = sizeof(QRgb);
+    int minimum = 0;
+    int maximum = 255;
+
+    int level = 128;
+    int window = 256;
+
+    // Colors of each 8-bit value in the window
+    QVector<QRgb> lut;
+    int w = 0;
+    int h = 0;
+    int d = 0;
+
+    // Number of bricks along x and y
+    int bw = 0;
+    int bh = 0;
+};
+
+#endif // VOLUME_H
@@ -1,5 +1,32 @@
 #include "cuboidlabel.h"
 
+CuboidLabel::CuboidLabel() :
+    x1(0), y1(0), z1(0), x2(0), y2(0), z2(0)
+{
+}
+
+CuboidLabel::CuboidLabel(int x1, int y1, int z1, int x2, int y2, int z2, const QString& tag, const QPen& pen, const QBrush& brush) :
+    x1(x1), y1(y1), z1(z1), x2(x2), y2(y2), z2(z2),
+    style(tag, pen, brush)
+{
+}
+
+const QString& CuboidLabel::tag() const {
+    return style.get().tag;
+}
+
+const QPen& CuboidLabel::pen() const {
+    return style.get().pen;
+}
+
+const QBrush& CuboidLabel::brush() const {
+    return style.get().brush;
+}
+
+void CuboidLabel::setStyle(const QString& tag, const QPen& pen, const QBrush& brush) {
+    style = StyleRef(tag, pen, brush);
+}
+
 QPainterPath CuboidLabel::rectPath(QRect rect) {
     QPainterPath path;
     path.addRect(rect);
@@ -7,7 +34,12 @@ QPainterPath CuboidLabel::rectPath(QRect rect) {
 }
 
 Label CuboidLabel::toLabel(QRect rect) const {
-    return {tag, Label::Rect, pen, brush, rectPath(rect)};
+    // The style is shared with the label
+    Label label;
+    label.style = style;
+    label.shape = Label::Rect;
+    label.path = rectPath(rect);
+    return label;
 }
 
 Label CuboidLabel::top() const {
@@ -27,9 +59,14 @@ bool CuboidLabel::contains(int x, int y, int z) const {
 }
 
 QDataStream& operator<<(QDataStream& o, const CuboidLabel& l) {
-    return o << l.x1 << l.y1 << l.z1 << l.x2 << l.y2 << l.z2 << l.tag << l.pen << l.brush;
+    return o << l.x1 << l.y1 << l.z1 << l.x2 << l.y2 << l.z2 << l.tag() << l.pen() << l.brush();
 }
 
 QDataStream& operator>>(QDataStream& i, CuboidLabel& l) {
-    return i >> l.x1 >> l.y1 >> l.z1 >> l.x2 >> l.y2 >> l.z2 >> l.tag >> l.pen >> l.brush;
+    QString tag;
+    QPen pen;
+    QBrush brush;
+    i >> l.x1 >> l.y1 >> l.z1 >> l.x2 >> l.y2 >> l.z2 >> tag >> pen >> brush;
+    l.setStyle(tag, pen, brush);
+    return i;
 }
@@ -8,6 +8,15 @@
 
 class CuboidLabel {
 public:
+    CuboidLabel();
+    CuboidLabel(int x1, int y1, int z1, int x2, int y2, int z2, const QString& tag, const QPen& pen, const QBrush& brush);
+
+    // The tag, pen and brush are kept in the style table
+    const QString& tag() const;
+    const QPen& pen() const;
+    const QBrush& brush() const;
+    void setStyle(const QString& tag, const QPen& pen, const QBrush& brush);
+
     static QPainterPath rectPath(QRect rect);
 
     // Ignore cuboid information
@@ -21,9 +30,9 @@ public:
 
 public:
     int x1, y1, z1, x2, y2, z2;
-    QString tag;
-    QPen pen;
-    QBrush brush;
+
+    // Shared with other labels of the same tag and colors
+    StyleRef style;
 };
 
 QDataStream& operator<<(QDataStream& o, const CuboidLabel& l);
@@ -1,18 +1,97 @@
 #include "label.h"
 
+Label::Label() :
+    shape(Rect)
+{
+}
+
+Label::Label(const QString& tag, int shape, const QPen& pen, const QBrush& brush, const QPainterPath& path) :
+    style(tag, pen, brush),
+    shape(shape),
+    path(path)
+{
+}
+
+const QString& Label::tag() const {
+    return style.get().tag;
+}
+
+const QPen& Label::pen() const {
+    return style.get().pen;
+}
+
+const QBrush& Label::brush() const {
+    return style.get().brush;
+}
+
+void Label::setStyle(const QString& tag, const QPen& pen, const QBrush& brush) {
+    style = StyleRef(tag, pen, brush);
+}
+
 void Label::setColor(const QColor& color) {
+    QPen pen = this->pen();
     pen.setColor(color.rgb());
-    brush = QBrush(color);
+    setStyle(tag(), pen, QBrush(color));
+    mask.setColor(color);
+}
+
+void Label::paint(QPainter* painter) const {
+    if (shape == Mask) {
+        mask.paint(painter);
+        return;
+    }
+    const StyleTable::Style& s = style.get();
+    painter->setPen(s.pen);
+    painter->setBrush(s.brush);
+    painter->drawPath(path);
+}
+
+bool Label::contains(const QPointF& pos) const {
+    if (shape == Mask)
+        return mask.contains(QPoint(qFloor(pos.x()), qFloor(pos.y())));
+    return path.contains(pos);
+}
+
+QRectF Label::boundingRect() const {
+    if (shape == Mask)
+        return mask.boundingRect();
+    return path.boundingRect();
 }
 
 QPen Label::getPen(const QColor& color) {
     return QPen(QBrush(color.rgb()), 4);
 }
 
+// Paths shared by copies of the same label are compared by pointer first
+// Equal styles have the same ID
+bool operator==(const Label& a, const Label& b) {
+    return a.shape == b.shape && a.style == b.style && a.path == b.path && a.mask == b.mask;
+}
+
+bool operator!=(const Label& a, const Label& b) {
+    return !(a == b);
+}
+
+// Masks are appended so that files without masks keep the old layout
 QDataStream& operator<<(QDataStream& o, const Label& l) {
-    return o << l.tag << l.shape << l.pen << l.brush << l.path;
+    o << l.tag() << l.shape << l.pen() << l.brush() << l.path;
+    if (l.shape == Label::Mask)
+        o << l.mask;
+    return o;
 }
 
 QDataStream& operator>>(QDataStream& i, Label& l) {
-    return i >> l.tag >> l.shape >> l.pen >> l.brush >> l.path;
+    QString tag;
+    QPen pen;
+    QBrush brush;
+    i >> tag >> l.shape >> pen >> brush >> l.path;
+    l.setStyle(tag, pen, brush);
+    if (!l.style.isValid() || l.shape < Label::Rect || l.shape > Label::Mask)
+        i.setStatus(QDataStream::ReadCorruptData);
+    l.mask = RegionMask();
+    if (l.shape == Label::Mask) {
+        i >> l.mask;
+        l.mask.setColor(brush.color());
+    }
+    return i;
 }
@@ -2,29 +2,54 @@
 #define LABEL_H
 
 #include <QtWidgets>
+#include "regionmask.h"
+#include "styletable.h"
 
 // Store label data
 
 class Label {
 public:
-    enum Shape {Rect, Poly, Curve, Region};
+    enum Shape {Rect, Poly, Curve, Region, Mask};
 
 public:
+    Label();
+    Label(const QString& tag, int shape, const QPen& pen, const QBrush& brush, const QPainterPath& path = QPainterPath());
+
+    // The tag, pen and brush are kept in the style table
+    const QString& tag() const;
+    const QPen& pen() const;
+    const QBrush& brush() const;
+    void setStyle(const QString& tag, const QPen& pen, const QBrush& brush);
+
     void setColor(const QColor& color);
 
+    // Masks are painted and tested by pixels instead of the path
+    void paint(QPainter* painter) const;
+    bool contains(const QPointF& pos) const;
+    QRectF boundingRect() const;
+
 public:
     // All shapes use the same pen style
     // so just specify the color
     static QPen getPen(const QColor& color);
 
 public:
-    QString tag;
+    // Shared with other labels of the same tag and colors
+    StyleRef style;
     int shape;
-    QPen pen;
-    QBrush brush;
     QPainterPath path;
+
+    // Only used by masks
+    RegionMask mask;
 };
 
+// Every member is a single pointer or int,
+// so lists keep labels inline instead of allocating each one
+Q_DECLARE_TYPEINFO(Label, Q_MOVABLE_TYPE);
+
+bool operator==(const Label& a, const Label& b);
+bool operator!=(const Label& a, const Label& b);
+
 QDataStream& operator<<(QDataStream& o, const Label& l);
 QDataStream& operator>>(QDataStream& i, Label& l);
 
@@ -0,0 +1,215 @@
+#include "regionmask.h"
+
+bool RegionMask::isEmpty() const {
+    return !d || d->bounds.isEmpty();
+}
+
+QRect RegionMask::boundingRect() const {
+    return d ? d->bounds : QRect();
+}
+
+bool RegionMask::contains(const QPoint& pos) const {
+    if (!d || !d->bounds.contains(pos))
+        return false;
+    return d->bits.constScanLine(pos.y() - d->origin.y())[pos.x() - d->origin.x()];
+}
+
+qint64 RegionMask::byteCount() const {
+    return d ? d->bits.sizeInBytes() : 0;
+}
+
+const uchar* RegionMask::scanLine(int y) const {
+    Q_ASSERT(d && y >= d->bounds.top() && y <= d->bounds.bottom());
+    return d->bits.constScanLine(y - d->origin.y()) + (d->bounds.left() - d->origin.x());
+}
+
+void RegionMask::setColor(const QColor& color) {
+    if (d && d->rgba == color.rgba())
+        return;
+    detach();
+    d->rgba = color.rgba();
+    if (!d->bits.isNull())
+        d->bits.setColor(1, d->rgba);
+}
+
+void RegionMask::stamp(const QPoint& center, int radius) {
+    reserve(QRect(center, center).adjusted(-radius, -radius, radius, radius));
+    applyKernel(center, kernel(radius));
+}
+
+void RegionMask::stroke(const QPoint& p1, const QPoint& p2, int radius) {
+    reserve(QRect(p1, p2).normalized().adjusted(-radius, -radius, radius, radius));
+    QVector<int> k = kernel(radius);
+    QPoint delta = p2 - p1;
+    int steps = qMax(qAbs(delta.x()), qAbs(delta.y()));
+    for (int i = 1; i <= steps; ++i)
+        applyKernel(p1 + delta*i/steps, k);
+}
+
+void RegionMask::paint(QPainter* painter) const {
+    if (isEmpty())
+        return;
+    // Only the part in the clip is converted for drawing
+    QRect rect = d->bounds;
+    if (painter->hasClipping())
+        rect &= painter->clipBoundingRect().toAlignedRect();
+    if (!rect.isEmpty())
+        painter->drawImage(rect.topLeft(), d->bits.copy(rect.translated(-d->origin)));
+}
+
+QPainterPath RegionMask::toPath() const {
+    if (isEmpty())
+        return QPainterPath();
+    QRegion region;
+    QRect rect = d->bounds.translated(-d->origin);
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        const uchar* line = d->bits.constScanLine(y);
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            if (!line[x])
+                continue;
+            int start = x;
+            while (x <= rect.right() && line[x])
+                ++x;
+            region += QRect(start, y, x - start, 1).translated(d->origin);
+        }
+    }
+    QPainterPath path;
+    path.addRegion(region);
+    return path.simplified();
+}
+
+RegionMask RegionMask::fromPath(const QPainterPath& path) {
+    RegionMask mask;
+    QRect rect = path.boundingRect().toAlignedRect();
+    if (rect.isEmpty())
+        return mask;
+    QImage img(rect.size(), QImage::Format_ARGB32_Premultiplied);
+    img.fill(Qt::transparent);
+    QPainter painter(&img);
+    painter.translate(-rect.topLeft());
+    painter.fillPath(path, Qt::black);
+    painter.end();
+
+    mask.reserve(rect, true);
+    for (int y = 0; y < img.height(); ++y) {
+        const QRgb* line = reinterpret_cast<const QRgb*>(img.constScanLine(y));
+        for (int x = 0; x < img.width(); ++x) {
+            if (qAlpha(line[x]) < 0x80)
+                continue;
+            int start = x;
+            while (x < img.width() && qAlpha(line[x]) >= 0x80)
+                ++x;
+            mask.fillSpan(rect.top() + y, rect.left() + start, rect.left() + x - 1);
+            mask.d->bounds |= QRect(rect.left() + start, rect.top() + y, x - start, 1);
+        }
+    }
+    return mask;
+}
+
+bool RegionMask::operator==(const RegionMask& other) const {
+    if (d == other.d)
+        return true;
+    if (isEmpty() || other.isEmpty())
+        return isEmpty() && other.isEmpty();
+    return d->origin == other.d->origin && d->bounds == other.d->bounds && d->bits == other.d->bits;
+}
+
+QVector<int> RegionMask::kernel(int radius) {
+    QVector<int> k;
+    for (int dy = -radius; dy <= radius; ++dy)
+        k << qRound(qSqrt(radius*radius - dy*dy));
+    return k;
+}
+
+void RegionMask::reserve(const QRect& rect, bool exact) {
+    detach();
+    QRect allocated(d->origin, d->bits.size());
+    if (!d->bits.isNull() && allocated.contains(rect))
+        return;
+    QRect wanted = d->bits.isNull() ? rect : allocated.united(rect);
+    if (!exact) {
+        int dx = qMax(64, wanted.width()/2);
+        int dy = qMax(64, wanted.height()/2);
+        wanted.adjust(-dx, -dy, dx, dy);
+    }
+    QImage grown(wanted.size(), QImage::Format_Indexed8);
+    grown.setColorTable({0, d->rgba});
+    grown.fill(0);
+    if (!d->bits.isNull()) {
+        QPoint offset = d->origin - wanted.topLeft();
+        for (int y = 0; y < d->bits.height(); ++y)
+            memcpy(grown.scanLine(y + offset.y()) + offset.x(), d->bits.constScanLine(y), d->bits.width());
+    }
+    d->bits = grown;
+    d->origin = wanted.topLeft();
+}
+
+void RegionMask::applyKernel(const QPoint& center, const QVector<int>& kernel) {
+    int radius = kernel.size()/2;
+    for (int dy = -radius; dy <= radius; ++dy) {
+        int w = kernel[dy + radius];
+        fillSpan(center.y() + dy, center.x() - w, center.x() + w);
+    }
+    d->bounds |= QRect(center, center).adjusted(-radius, -radius, radius, radius);
+}
+
+void RegionMask::fillSpan(int y, int x1, int x2) {
+    memset(d->bits.scanLine(y - d->origin.y()) + x1 - d->origin.x(), 1, x2 - x1 + 1);
+}
+
+void RegionMask::detach() {
+    if (!d)
+        d = new Data;
+    else
+        d.detach();
+}
+
+QDataStream& operator<<(QDataStream& o, const RegionMask& m) {
+    QRect bounds = m.boundingRect();
+    o << bounds;
+    if (bounds.isEmpty())
+        return o;
+    const RegionMask::Data* d = m.d.constData();
+    QRect rect = bounds.translated(-d->origin);
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        const uchar* line = d->bits.constScanLine(y);
+        QVector<QPair<quint32, quint32>> runs;
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            if (!line[x])
+                continue;
+            int start = x;
+            while (x <= rect.right() && line[x])
+                ++x;
+            runs << qMakePair(quint32(start - rect.left()), quint32(x - start));
+        }
+        o << runs;
+    }
+    return o;
+}
+
+QDataStream& operator>>(QDataStream& i, RegionMask& m) {
+    QRect bounds;
+    i >> bounds;
+    m = RegionMask();
+    if (bounds.isEmpty())
+        return i;
+    m.reserve(bounds, true);
+    if (m.d->bits.isNull()) {
+        i.setStatus(QDataStream::ReadCorruptData);
+        return i;
+    }
+    m.d->bounds = bounds;
+    for (int y = bounds.top(); y <= bounds.bottom() && i.status() == QDataStream::Ok; ++y) {
+        QVector<QPair<quint32, quint32>> runs;
+        i >> runs;
+        for (const auto& run: runs) {
+            if (run.first + run.second > quint32(bounds.width())) {
+                i.setStatus(QDataStream::ReadCorruptData);
+                break;
+            }
+            if (run.second)
+                m.fillSpan(y, bounds.left() + run.first, bounds.left() + run.first + run.second - 1);
+        }
+    }
+    return i;
+}
@@ -0,0 +1,78 @@
+#ifndef REGIONMASK_H
+#define REGIONMASK_H
+
+#include <QtGui>
+
+// Store a region as a bitmap instead of a path
+// Painting with a round brush only touches the pixels under the brush
+// so the cost of a stroke does not depend on the area already painted
+// The pixels are shared until modified, and empty masks allocate nothing,
+// so a mask only takes a pointer in labels of other shapes
+
+class RegionMask {
+public:
+    bool isEmpty() const;
+    QRect boundingRect() const;
+    bool contains(const QPoint& pos) const;
+    qint64 byteCount() const;
+
+    // Pixels of row y starting from the left of the bounding rect, 1 if set
+    // The row must be within the bounding rect
+    const uchar* scanLine(int y) const;
+
+    void setColor(const QColor& color);
+
+    // Paint a round brush at a point or along a segment
+    void stamp(const QPoint& center, int radius);
+    void stroke(const QPoint& p1, const QPoint& p2, int radius);
+
+    void paint(QPainter* painter) const;
+
+    // Conversion from and to the path form of a region
+    QPainterPath toPath() const;
+    static RegionMask fromPath(const QPainterPath& path);
+
+    bool operator==(const RegionMask& other) const;
+
+private:
+    // Half widths of each row of a round brush
+    static QVector<int> kernel(int radius);
+
+    // Make sure pixels in the rect can be set
+    // Leave some margin unless exact to avoid reallocating for each stroke
+    void reserve(const QRect& rect, bool exact = false);
+
+    void applyKernel(const QPoint& center, const QVector<int>& kernel);
+
+    // Set pixels in [x1, x2] of row y
+    void fillSpan(int y, int x1, int x2);
+
+    // Detach and allocate the pixels if needed
+    void detach();
+
+private:
+    struct Data : QSharedData {
+        // Pixels with index 1 are set
+        QImage bits;
+        QPoint origin;
+
+        // Bounding rect of set pixels
+        QRect bounds;
+
+        QRgb rgba = 0;
+    };
+
+    // Null while nothing is set and no color is given
+    QSharedDataPointer<Data> d;
+
+    friend QDataStream& operator<<(QDataStream& o, const RegionMask& m);
+    friend QDataStream& operator>>(QDataStream& i, RegionMask& m);
+};
+
+// Rows are stored as runs of set pixels
+QDataStream& operator<<(QDataStream& o, const RegionMask& m);
+QDataStream& operator>>(QDataStream& i, RegionMask& m);
+
+Q_DECLARE_TYPEINFO(RegionMask, Q_MOVABLE_TYPE);
+
+#endif // REGIONMASK_H
@@ -1,5 +1,7 @@
 #include "renderarea.h"
 #include "util.h"
+#include "trace.h"
+#include "undostack.h"
 
 RenderArea::RenderArea(QWidget* parent) :
     QLabel(parent)
@@ -7,23 +9,92 @@ RenderArea::RenderArea(QWidget* parent) :
     setMouseTracking(true);
     setBackgroundRole(QPalette::Base);
     setPixmap(QPixmap());
-    connect(this, &RenderArea::painted, this, QOverload<>::of(&RenderArea::update));
-    connect(this, &RenderArea::labelUpdated, this, &RenderArea::painted);
-    connect(this, &RenderArea::labelUpdated, std::bind(&RenderArea::setSelectedLabel, this, nullptr));
+    connect(this, &RenderArea::painted, [=] (const QRectF& rect) {
+        // Only inputs that change the labels count towards the latency of the next paint
+        TRACE_UPDATE();
+        if (rect.isNull()) {
+            update();
+            return;
+        }
+        // Leave a margin for the pen of the brush and antialiasing
+        int margin = qCeil(painting ? labels.last().pen().widthF() : 0) + 2;
+        update(QRectF(mapFromImage(rect.topLeft()), mapFromImage(rect.bottomRight())).toAlignedRect().adjusted(-margin, -margin, margin, margin));
+    });
+    connect(this, &RenderArea::labelUpdated, [=] () {
+        emit painted();
+    });
+    // Keep the selection unless its label is gone
+    connect(this, &RenderArea::labelUpdated, [=] () {
+        if (!labels.contains(selectedKey))
+            setSelectedLabel(0);
+    });
+    connect(this, &RenderArea::labelUpdated, [=] () {
+        gridDirty = true;
+        layerDirty = true;
+    });
     connect(this, &RenderArea::labelChanged, this, &RenderArea::labelUpdated);
+    connect(&pyramid, &ImagePyramid::changed, this, QOverload<>::of(&RenderArea::update));
+}
+
+void RenderArea::setImage(const QImage& img) {
+    setPixmap(QPixmap());
+    pyramid.setImage(img);
+    layerDirty = true;
+    adjustSize();
+    update();
+}
+
+void RenderArea::setImageFile(TileDecoder* decoder, const QString& fileName) {
+    setPixmap(QPixmap());
+    pyramid.setSource(decoder, fileName);
+    layerDirty = true;
+    adjustSize();
+    update();
+}
+
+bool RenderArea::hasImage() const {
+    return !pyramid.isNull() || (pixmap() && !pixmap()->isNull());
+}
+
+qreal RenderArea::zoom() const {
+    return zoomFactor;
+}
+
+void RenderArea::setZoom(qreal zoom) {
+    if (zoom == zoomFactor)
+        return;
+    zoomFactor = zoom;
+    layerDirty = true;
+    adjustSize();
+    update();
+}
+
+QPointF RenderArea::mapToImage(const QPointF& pos) const {
+    return pos/zoomFactor;
+}
+
+QPointF RenderArea::mapFromImage(const QPointF& pos) const {
+    return pos*zoomFactor;
+}
+
+QSize RenderArea::sizeHint() const {
+    if (pyramid.isNull())
+        return QLabel::sizeHint();
+    return (QSizeF(pyramid.size())*zoomFactor).toSize();
 }
 
 const QList<Label>& RenderArea::labelList() const {
-    return labels;
+    return labels.list();
 }
 
 void RenderArea::setLabelList(const QList<Label>& labelList) {
-    labels = labelList;
+    UndoStack::Edit edit = UndoStack::diff(labels.list(), labelList);
+    labels.replace(edit.index, edit.removed.size(), edit.inserted);
     emit labelUpdated();
 }
 
 void RenderArea::appendLabel(const Label& label) {
-    labels << label;
+    labels.append(label);
     emit labelUpdated();
 }
 
@@ -33,101 +104,147 @@ void RenderArea::setLabelVisible(bool visible) {
 }
 
 void RenderArea::newLabel(const Label& label) {
-    labels << label;
+    labels.append(label);
+    labels.last().mask.setColor(label.brush().color());
     painting = true;
     emit painted();
 }
 
 void RenderArea::remove(const QString& tag) {
-    bool changed = false;
-    QList<Label> rested;
-    for (const Label& label: labels) {
-        if (label.tag != tag)
-            rested << label;
-        else
-            changed = true;
-    }
-    if (changed) {
-        labels = rested;
+    if (labels.removeIf([&] (const Label& label) { return label.tag() == tag; }))
         emit labelChanged();
-    }
 }
 
 void RenderArea::removeSelectedLabel() {
-    for (auto it = labels.begin(); it != labels.end(); ++it)
-        if (&*it == selectedLabel) {
-            labels.erase(it);
-            setSelectedLabel(nullptr);
-            emit labelChanged();
-            break;
-        }
+    if (labels.remove(selectedKey))
+        emit labelChanged();
 }
 
-void RenderArea::loadLabels(const QString& fileName) {
-    labels.clear();
-    QFile file(fileName);
-    if (file.open(QIODevice::ReadOnly)) {
-        QDataStream istream(&file);
-        istream >> labels;
-    }
+void RenderArea::convertSelectedLabel() {
+    const Label* label = labels.value(selectedKey);
+    if (!label || label->shape != Label::Region)
+        return;
+    Label converted = *label;
+    converted.shape = Label::Mask;
+    converted.path = QPainterPath();
+    converted.mask = RegionMask::fromPath(label->path);
+    converted.mask.setColor(label->brush().color());
+    int index = labels.indexOf(selectedKey);
+    labels.replace(index, 1, {converted});
+    setSelectedLabel(labels.keyAt(index));
+    emit labelChanged();
+}
+
+const Label* RenderArea::label(LabelKey key) const {
+    return labels.value(key);
+}
+
+RenderArea::LabelKey RenderArea::selectedLabel() const {
+    return selectedKey;
+}
+
+void RenderArea::loadLabelList(const QList<Label>& labelList) {
+    labels.assign(labelList);
     // Randomly reset color
     /*
-    for (auto& label: labels) {
+    for (int i = 0; i < labels.size(); ++i) {
+        Label& label = labels[i];
         QColor color = randomColor();
-        if (label.pen != Qt::NoPen)
-            label.pen = Label::getPen(color);
-        color.setAlpha(label.brush.color().alpha());
-        label.brush.setColor(color);
+        color.setAlpha(label.brush().color().alpha());
+        label.setColor(color);
     }
     */
     emit labelChanged();
 }
 
-void RenderArea::saveLabels(const QString& fileName) {
-    QFile file(fileName);
-    if (file.open(QIODevice::WriteOnly)) {
-        QDataStream ostream(&file);
-        ostream << labels;
+QList<Label> RenderArea::readLabels(const QString& fileName) {
+    QList<Label> labelList;
+    LabelFile::read(fileName, &labelList);
+    return labelList;
+}
+
+bool RenderArea::loadLabels(const QString& fileName) {
+    QList<Label> labelList;
+    bool ok = LabelFile::read(fileName, &labelList);
+    loadLabelList(labelList);
+    return ok;
+}
+
+bool RenderArea::saveLabels(const QString& fileName, int format) {
+    return LabelFile::write(fileName, labels.list(), format);
+}
+
+void RenderArea::composite(const QRect& rect, QImage* img) {
+    if (img->size() != rect.size() || img->format() != QImage::Format_ARGB32_Premultiplied)
+        *img = QImage(rect.size(), QImage::Format_ARGB32_Premultiplied);
+    img->fill(Qt::transparent);
+    QPainter painter(img);
+    painter.translate(-rect.topLeft());
+    painter.setClipRect(rect);
+    if (!pyramid.isNull())
+        pyramid.paint(&painter, rect, zoomFactor);
+    else if (pixmap())
+        painter.drawPixmap(rect, *pixmap(), rect);
+    if (!labelVisible)
+        return;
+    ensureLayer(rect);
+    painter.drawImage(layerRect.topLeft(), layer);
+    if (painting) {
+        painter.scale(zoomFactor, zoomFactor);
+        labels.last().paint(&painter);
     }
 }
 
 void RenderArea::paintEvent(QPaintEvent* event) {
-    QLabel::paintEvent(event);
+    TRACE_FRAME("RenderArea::paintEvent");
+    if (pyramid.isNull())
+        QLabel::paintEvent(event);
+    QPainter painter(this);
+    painter.setClipRect(event->rect());
+    if (!pyramid.isNull())
+        pyramid.paint(&painter, event->rect(), zoomFactor);
     if (!labelVisible)
         return;
-    QPainter painter(this);
-    for (const Label& label: labels) {
-        QPen pen = label.pen;
-        // Always show border when drawing a polygon or a closed curve
-        /*
-        if (painting && &label == &labels.last()) {
-            switch (label.shape) {
-            case Label::Poly:
-            case Label::Curve:
-                pen = Label::getPen(label.brush.color());
-            }
-        }
-        */
-        painter.setPen(pen);
-        painter.setBrush(label.brush);
-        painter.drawPath(label.path);
-    }
+    ensureLayer(event->rect());
+    painter.drawImage(layerRect.topLeft(), layer);
+    if (!painting)
+        return;
+
+    // Only the label being drawn changes between frames
+    const Label& label = labels.last();
+    painter.save();
+    painter.scale(zoomFactor, zoomFactor);
+    label.paint(&painter);
+    painter.restore();
 
     // Draw an extra pen when drawing a region
-    if (painting && labels.last().shape == Label::Region)
-        painter.drawEllipse(mapFromGlobal(QCursor::pos()), Radius, Radius);
+    if (label.shape == Label::Region || label.shape == Label::Mask) {
+        painter.setPen(label.pen());
+        painter.setBrush(label.brush());
+        painter.drawEllipse(mapFromGlobal(QCursor::pos()), Radius*zoomFactor, Radius*zoomFactor);
+    }
 }
 
 void RenderArea::mousePressEvent(QMouseEvent* event) {
+    TRACE_INPUT();
+    TRACE_SCOPE("RenderArea::mousePressEvent");
     emit mousePressed(this);
+    QPointF pos = imagePos(event);
 
     // Set selected label
+    // The last label containing the point is on the top
     if (!painting) {
-        Label* ptr = nullptr;
-        for (Label& label: labels)
-            if (label.path.contains(event->pos()))
-                ptr = &label;
-        setSelectedLabel(ptr);
+        if (gridDirty) {
+            grid.build(labels.list());
+            gridDirty = false;
+        }
+        LabelKey key = 0;
+        for (int i: grid.candidates(pos))
+            if (labels.at(i).contains(pos)) {
+                key = labels.keyAt(i);
+                break;
+            }
+        setSelectedLabel(key);
         return;
     }
 
@@ -135,16 +252,16 @@ void RenderArea::mousePressEvent(QMouseEvent* event) {
     switch(labels.last().shape) {
     case Label::Rect:
         if (event->button() == Qt::LeftButton) {
-            path.moveTo(event->pos());
+            path.moveTo(pos);
         }
         break;
 
     case Label::Region:
         if (event->button() == Qt::LeftButton) {
             QPainterPath circ;
-            circ.addEllipse(event->pos(), Radius, Radius);
+            circ.addEllipse(pos, Radius, Radius);
             path |= circ;
-            lastPos = event->pos();
+            lastPos = pos;
             emit painted();
         }
         if (event->button() == Qt::RightButton) {
@@ -153,13 +270,25 @@ void RenderArea::mousePressEvent(QMouseEvent* event) {
         }
         break;
 
+    case Label::Mask:
+        if (event->button() == Qt::LeftButton) {
+            labels.last().mask.stamp(QPoint(qFloor(pos.x()), qFloor(pos.y())), Radius);
+            lastPos = pos;
+            emit painted(QRectF(pos, pos).adjusted(-Radius - 1, -Radius - 1, Radius + 1, Radius + 1));
+        }
+        if (event->button() == Qt::RightButton) {
+            painting = false;
+            emit labelChanged();
+        }
+        break;
+
     case Label::Poly:
         if (event->button() == Qt::LeftButton) {
             if (!path.elementCount()) {
-                path.moveTo(event->pos());
+                path.moveTo(pos);
                 lastPath = path;
             } else {
-                lastPath.lineTo(event->pos());
+                lastPath.lineTo(pos);
                 path = lastPath;
                 emit painted();
             }
@@ -175,16 +304,16 @@ void RenderArea::mousePressEvent(QMouseEvent* event) {
     case Label::Curve:
         if (event->button() == Qt::LeftButton) {
             if (!path.elementCount()) {
-                path.moveTo(event->pos());
+                path.moveTo(pos);
                 lastPath = path;
                 currentPath = path;
             } else {
                 if (lastPath == currentPath) {
-                    currentPath.lineTo(event->pos());
+                    currentPath.lineTo(pos);
                 } else {
                     QPointF endPt = currentPath.currentPosition();
                     currentPath = lastPath;
-                    currentPath.quadTo(event->pos(), endPt);
+                    currentPath.quadTo(pos, endPt);
                 }
                 path = currentPath;
                 emit painted();
@@ -215,6 +344,8 @@ void RenderArea::mousePressEvent(QMouseEvent* event) {
 }
 
 void RenderArea::mouseReleaseEvent(QMouseEvent* event) {
+    TRACE_INPUT();
+    TRACE_SCOPE("RenderArea::mouseReleaseEvent");
     if (!painting)
         return;
     if (labels.last().shape == Label::Rect) {
@@ -226,7 +357,12 @@ void RenderArea::mouseReleaseEvent(QMouseEvent* event) {
 }
 
 void RenderArea::mouseMoveEvent(QMouseEvent* event) {
-    emit mouseMoved(event->pos());
+    TRACE_INPUT();
+    TRACE_SCOPE("RenderArea::mouseMoveEvent");
+    QPointF pos = imagePos(event);
+    QPointF previous = cursorPos;
+    cursorPos = pos;
+    emit mouseMoved(QPoint(qFloor(pos.x()), qFloor(pos.y())));
     if (!painting)
         return;
 
@@ -235,7 +371,7 @@ void RenderArea::mouseMoveEvent(QMouseEvent* event) {
     case Label::Rect:
         if (event->buttons() & Qt::LeftButton) {
             QPointF p1 = path.currentPosition();
-            QPointF p2 = event->pos();
+            QPointF p2 = pos;
             path = QPainterPath();
             path.addRect(QRectF(QPointF(qMin(p1.x(), p2.x()), qMin(p1.y(), p2.y())), QPointF(qMax(p1.x(), p2.x()), qMax(p1.y(), p2.y()))));
             path.moveTo(p1);
@@ -246,26 +382,39 @@ void RenderArea::mouseMoveEvent(QMouseEvent* event) {
     case Label::Region:
         // To draw a "line with width", draw a rotated rectangle
         if (event->buttons() & Qt::LeftButton) {
-            qreal dx = event->x() - lastPos.x();
-            qreal dy = event->y() - lastPos.y();
+            qreal dx = pos.x() - lastPos.x();
+            qreal dy = pos.y() - lastPos.y();
             QMatrix trans;
             trans.rotate(qAtan2(dy, dx) / M_PI * 180);
             QPainterPath rect;
             rect.addPolygon(trans.map(QPolygonF(QRectF(0, -Radius, qSqrt(dx*dx + dy*dy), Radius*2))));
             rect.translate(lastPos);
             QPainterPath circ;
-            circ.addEllipse(event->pos(), Radius, Radius);
+            circ.addEllipse(pos, Radius, Radius);
             path |= rect | circ;
-            lastPos = event->pos();
+            lastPos = pos;
         }
         emit painted();
         break;
 
+    case Label::Mask: {
+        // Only pixels under the brush are touched, and only the widget over them and over the brush
+        // before and after the move is repainted, so the cost doesn't grow with the painted area
+        QRectF dirty = QRectF(previous, pos).normalized();
+        if (event->buttons() & Qt::LeftButton) {
+            labels.last().mask.stroke(QPoint(qFloor(lastPos.x()), qFloor(lastPos.y())), QPoint(qFloor(pos.x()), qFloor(pos.y())), Radius);
+            dirty |= QRectF(lastPos, pos).normalized();
+            lastPos = pos;
+        }
+        emit painted(dirty.adjusted(-Radius - 1, -Radius - 1, Radius + 1, Radius + 1));
+        break;
+    }
+
     case Label::Poly:
         if (!path.elementCount())
             break;
         path = lastPath;
-        path.lineTo(event->pos());
+        path.lineTo(pos);
         emit painted();
         break;
 
@@ -274,16 +423,56 @@ void RenderArea::mouseMoveEvent(QMouseEvent* event) {
             break;
         if (lastPath == currentPath) {
             path = lastPath;
-            path.lineTo(event->pos());
+            path.lineTo(pos);
             emit painted();
         }
         break;
     }
 }
 
-void RenderArea::setSelectedLabel(Label* label) {
-    if (label != selectedLabel) {
-        selectedLabel = label;
-        emit selectedLabelChanged(label);
+void RenderArea::ensureLayer(const QRect& rect) {
+    if (!layerDirty && layerRect.contains(rect) && layer.devicePixelRatio() == devicePixelRatioF())
+        return;
+    // Leave a margin so that scrolling a little reuses the layer
+    QRect visible = visibleRegion().boundingRect();
+    visible.adjust(-visible.width()/2, -visible.height()/2, visible.width()/2, visible.height()/2);
+    updateLayer((visible | rect) & this->rect());
+}
+
+void RenderArea::updateLayer(const QRect& rect) {
+    qreal ratio = devicePixelRatioF();
+    layerRect = rect;
+    layerDirty = false;
+    if (rect.isEmpty()) {
+        layer = QImage();
+        return;
+    }
+    if (layer.size() != rect.size()*ratio)
+        layer = QImage(rect.size()*ratio, QImage::Format_ARGB32_Premultiplied);
+    layer.setDevicePixelRatio(ratio);
+    layer.fill(Qt::transparent);
+
+    // The label being drawn is not committed yet
+    int count = painting ? labels.size() - 1 : labels.size();
+    QRectF visible(mapToImage(rect.topLeft()), mapToImage(rect.bottomRight() + QPoint(1, 1)));
+    QPainter painter(&layer);
+    painter.translate(-rect.topLeft());
+    painter.scale(zoomFactor, zoomFactor);
+    for (int i = 0; i < count; ++i) {
+        const Label& label = labels.at(i);
+        qreal margin = label.pen().widthF();
+        if (label.boundingRect().adjusted(-margin, -margin, margin, margin).intersects(visible))
+            label.paint(&painter);
+    }
+}
+
+QPointF RenderArea::imagePos(QMouseEvent* event) const {
+    return mapToImage(event->localPos());
+}
+
+void RenderArea::setSelectedLabel(LabelKey key) {
+    if (key != selectedKey) {
+        selectedKey = key;
+        emit selectedLabelChanged(key);
     }
 }
@@ -3,17 +3,45 @@
 
 #include <QtWidgets>
 #include "label.h"
+#include "imagepyramid.h"
+#include "labelfile.h"
+#include "labelgrid.h"
 #include "listex.h"
+#include "slotmap.h"
 
 // Widget to render an image and several labels
 // Inherit from QLabel for convenience to render an image
+// Large images set by setImage() are drawn through a pyramid instead and can be zoomed.
+// Labels are always in image coordinates and scaled when painted.
 
 class RenderArea : public QLabel {
     Q_OBJECT
 
+public:
+    // Stays valid until the label is removed or replaced
+    typedef SlotMap<Label>::Key LabelKey;
+
 public:
     RenderArea(QWidget* parent = nullptr);
+
+    // Only the tiles in view are drawn, at the level matching the zoom
+    void setImage(const QImage& img);
+    void setImageFile(TileDecoder* decoder, const QString& fileName);
+    bool hasImage() const;
+
+    // Only applies to images set by setImage()
+    qreal zoom() const;
+    void setZoom(qreal zoom);
+
+    QPointF mapToImage(const QPointF& pos) const;
+    QPointF mapFromImage(const QPointF& pos) const;
+
+    QSize sizeHint() const;
+
     const QList<Label>& labelList() const;
+
+    // Only labels differing from the current list are replaced
+    // so that the selection survives undoing unrelated edits
     void setLabelList(const QList<Label>& labelList);
     void appendLabel(const Label& label);
     void setLabelVisible(bool visible);
@@ -24,12 +52,31 @@ public:
     void remove(const QString& tag);
     void removeSelectedLabel();
 
+    // Replace the selected region by a mask of the same pixels, which is cheaper to paint on
+    void convertSelectedLabel();
+
+    // Null if the label is removed
+    const Label* label(LabelKey key) const;
+    LabelKey selectedLabel() const;
+
+    // Replace all labels as if loaded from a file
+    void loadLabelList(const QList<Label>& labelList);
+
+    // Safe to call from any thread
+    // Return no labels if the file is missing or malformed
+    static QList<Label> readLabels(const QString& fileName);
+
+    // Render the image and labels in a rect of the widget into a reused image
+    // Much cheaper than grab() since cached labels are not painted again
+    void composite(const QRect& rect, QImage* img);
+
 public slots:
-    void loadLabels(const QString& fileName);
-    void saveLabels(const QString& fileName);
+    bool loadLabels(const QString& fileName);
+    bool saveLabels(const QString& fileName, int format = LabelFile::Compact);
 
 signals:
-    void painted();
+    // Part of the image to repaint, null for all of it
+    void painted(const QRectF& rect = QRectF());
 
     // Implies painted()
     void labelUpdated();
@@ -37,7 +84,8 @@ signals:
     // Implies labelUpdated()
     void labelChanged();
 
-    void selectedLabelChanged(Label* label);
+    // The key is 0 if no label is selected
+    void selectedLabelChanged(LabelKey key);
 
     void mouseMoved(const QPoint& pos);
     void mousePressed(RenderArea* sender);
@@ -50,10 +98,34 @@ protected:
     void mouseMoveEvent(QMouseEvent* event);
 
 private:
-    void setSelectedLabel(Label* label);
+    void setSelectedLabel(LabelKey key);
+
+    // Make sure the cached layer covers a rect of the widget
+    void ensureLayer(const QRect& rect);
+
+    // Render committed labels in a rect of the widget into the cached layer
+    void updateLayer(const QRect& rect);
 
-    QList<Label> labels;
-    Label* selectedLabel = nullptr;
+    // Pixel of the image under a point of the widget
+    QPointF imagePos(QMouseEvent* event) const;
+
+    SlotMap<Label> labels;
+    LabelKey selectedKey = 0;
+
+    // Spatial index for selecting labels
+    // Rebuilt lazily after the label list is updated
+    LabelGrid grid;
+    bool gridDirty = true;
+
+    ImagePyramid pyramid;
+    qreal zoomFactor = 1;
+
+    // Committed labels rendered once and reused by every paint event
+    // Only covers the visible part of the widget with some margin
+    // Invalidated whenever the label list or the zoom is updated
+    QImage layer;
+    QRect layerRect;
+    bool layerDirty = true;
 
     // Whether the drawing of the new label is ongoing
     bool painting = false;
@@ -65,7 +137,10 @@ private:
     QPainterPath currentPath;
 
     // For drawing a region
-    QPoint lastPos;
+    QPointF lastPos;
+
+    // Position of the last mouse move, where the brush was drawn
+    QPointF cursorPos;
 
     // Radius of pen to draw a region
     static const int Radius = 8;
@@ -0,0 +1,53 @@
+#include "traceoverlay.h"
+#include <algorithm>
+
+TraceOverlay::TraceOverlay(QWidget* parent) :
+    QWidget(parent),
+    timer(new QTimer(this))
+{
+    setAttribute(Qt::WA_TransparentForMouseEvents);
+    resize(Frames*2 + 16, 120);
+    timer->setInterval(250);
+    connect(timer, &QTimer::timeout, this, QOverload<>::of(&TraceOverlay::update));
+}
+
+void TraceOverlay::paintEvent(QPaintEvent*) {
+    QVector<Trace::Event> frames;
+    for (const Trace::Event& event: Trace::instance()->events())
+        if (event.frame)
+            frames << event;
+    if (frames.size() > Frames)
+        frames = frames.mid(frames.size() - Frames);
+
+    QPainter painter(this);
+    painter.fillRect(rect(), QColor(0, 0, 0, 0xA0));
+    int top = 24;
+    int bottom = height() - 8;
+    qreal unit = (bottom - top)/(Scale*1e6);
+    // A line at 1/60 s
+    int budget = bottom - qRound(1e9/60*unit);
+    painter.setPen(QColor(0xFF, 0xFF, 0xFF, 0x60));
+    painter.drawLine(8, budget, width() - 8, budget);
+    for (int i = 0; i < frames.size(); ++i) {
+        int x = 8 + i*2;
+        qint64 latency = qMax(frames[i].latency, frames[i].duration);
+        painter.fillRect(QRect(QPoint(x, bottom - qMin(bottom - top, qRound(latency*unit))), QPoint(x, bottom)), QColor(0xFF, 0xA0, 0x40));
+        painter.fillRect(QRect(QPoint(x, bottom - qMin(bottom - top, qRound(frames[i].duration*unit))), QPoint(x, bottom)), QColor(0x40, 0xC0, 0xFF));
+    }
+
+    QVector<qint64> durations;
+    for (const Trace::Event& event: frames)
+        durations << event.duration;
+    std::sort(durations.begin(), durations.end());
+    painter.setPen(Qt::white);
+    if (!durations.isEmpty())
+        painter.drawText(8, 16, QString::asprintf("Frame: %.1f ms median, %.1f ms max", durations[durations.size()/2]/1e6, durations.last()/1e6));
+}
+
+void TraceOverlay::showEvent(QShowEvent*) {
+    timer->start();
+}
+
+void TraceOverlay::hideEvent(QHideEvent*) {
+    timer->stop();
+}
@@ -0,0 +1,32 @@
+#ifndef TRACEOVERLAY_H
+#define TRACEOVERLAY_H
+
+#include <QtWidgets>
+#include "trace.h"
+
+// Draw the duration and input-to-paint latency of recent frames over another widget
+// Each frame is a bar, with the latency drawn behind its duration
+// Mouse events pass through to the widgets below
+
+class TraceOverlay : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit TraceOverlay(QWidget* parent = nullptr);
+
+protected:
+    void paintEvent(QPaintEvent* event);
+    void showEvent(QShowEvent* event);
+    void hideEvent(QHideEvent* event);
+
+private:
+    QTimer* timer;
+
+    // Frames shown at once
+    static const int Frames = 120;
+
+    // Height of the overlay in milliseconds
+    static const int Scale = 50;
+};
+
+#endif // TRACEOVERLAY_H
@@ -3,6 +3,7 @@
 #include "subwindow.h"
 #include "labeldialog.h"
 #include "util.h"
+#include "traceoverlay.h"
 
 MainWindow::MainWindow(QWidget* parent) :
     QMainWindow(parent),
@@ -13,7 +14,8 @@ MainWindow::MainWindow(QWidget* parent) :
     dockStatus(new QDockWidget("Label Status")),
     status(new QListWidget),
     dockMagnifier(new QDockWidget("Magnifier")),
-    magnifier(new QLabel)
+    magnifier(new QLabel),
+    cursorSprite(QIcon(":/res/arrow.cur").pixmap(32))
 {
     ui->setupUi(this);
     setCentralWidget(area);
@@ -22,6 +24,7 @@ MainWindow::MainWindow(QWidget* parent) :
     area->setWidget(canvas);
     area->setMouseTracking(true);
     area->installEventFilter(this);
+    area->viewport()->installEventFilter(this);
     canvas->setVisible(false);
 
     status->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Expanding);
@@ -37,6 +40,9 @@ MainWindow::MainWindow(QWidget* parent) :
         ui->menuView->addAction(dock->toggleViewAction());
         dock->close();
     }
+#ifdef LABELING_TRACE
+    addTraceActions();
+#endif
     updateActions();
 
     connect(canvas, &RenderArea::painted, [=] () {
@@ -44,14 +50,66 @@ MainWindow::MainWindow(QWidget* parent) :
         if (canvas->rect().contains(pos))
             updateMagnifier(pos);
     });
+    // Nothing is magnified while the dock is hidden, so catch up when it's shown
+    connect(dockMagnifier, &QDockWidget::visibilityChanged, [=] (bool visible) {
+        if (visible && hasImage())
+            updateMagnifier(canvas->mapFromGlobal(QCursor::pos()));
+    });
     connect(canvas, &RenderArea::mouseMoved, [=] (const QPoint& pos) {
         ui->statusBar->showMessage(QString::asprintf("Cursor: (%d, %d)", pos.x(), pos.y()));
-        updateMagnifier(pos);
+        updateMagnifier(canvas->mapFromGlobal(QCursor::pos()));
+    });
+    connect(canvas, &RenderArea::selectedLabelChanged, [=] (RenderArea::LabelKey key) {
+        ui->actRemove->setEnabled(key != 0);
+        ui->actConvertToMask->setEnabled(key != 0 && canvas->label(key)->shape == Label::Region);
+        updateStatus(canvas->label(key));
     });
-    connect(canvas, &RenderArea::selectedLabelChanged, ui->actRemove, &QAction::setEnabled);
-    connect(canvas, &RenderArea::selectedLabelChanged, this, &MainWindow::updateStatus);
     connect(canvas, &RenderArea::labelChanged, this, &MainWindow::updateUndoList);
     connect(canvas, &RenderArea::labelUpdated, this, &MainWindow::updateActions);
+    connect(&tileDecoder, &TileDecoder::failed, this, [=] (const QString& fileName, const QString& error) {
+        QMessageBox::information(this, QGuiApplication::applicationDisplayName(), QString("Cannot decode %1: %2").arg(QDir::toNativeSeparators(fileName), error));
+    });
+    connect(&folderScanner, &FolderScanner::found, [=] (const QStringList& fileNames) {
+        bool first = files.empty();
+        files.append(fileNames);
+        datasetIndex.add(fileNames);
+        if (first) {
+            files.moveToBegin();
+            loadFile();
+        } else
+            updateActions();
+    });
+    connect(&folderScanner, &FolderScanner::finished, [=] () {
+        // Sort by name as a listing of the folder would
+        files.sort([] (const QString& a, const QString& b) {
+            return a.compare(b, Qt::CaseInsensitive) < 0;
+        });
+        updateActions();
+        imageCache.prefetch(files.list, files.it - files.list.begin());
+        // Images deleted since the index was saved are no longer counted
+        datasetIndex.prune();
+    });
+    connect(&datasetIndex, &DatasetIndex::updated, [=] () {
+        updateActions();
+        // Replace the message about images not indexed yet
+        if (indexPending && datasetIndex.isReady() && !folderScanner.isScanning()) {
+            indexPending = false;
+            ui->statusBar->showMessage("All images are indexed");
+        }
+    });
+    connect(&autoSaver, &AutoSaver::saved, this, [=] (const QString& fileName) {
+        // The file may belong to another image in the list
+        if (fileName.endsWith(".dat")) {
+            imageCache.invalidate(fileName.left(fileName.size() - 4));
+            datasetIndex.refresh(fileName.left(fileName.size() - 4));
+        }
+    });
+    connect(&autoSaver, &AutoSaver::failed, this, [=] (const QString& fileName, bool paused) {
+        QString message = QString("Cannot save %1").arg(QDir::toNativeSeparators(fileName));
+        if (paused)
+            message += "\nAuto saving is paused for this file until it's saved";
+        QMessageBox::information(this, QGuiApplication::applicationDisplayName(), message);
+    });
 }
 
 MainWindow::~MainWindow() {
@@ -60,35 +118,43 @@ MainWindow::~MainWindow() {
 }
 
 bool MainWindow::hasImage() const {
-    return !canvas->pixmap()->isNull();
+    return canvas->hasImage();
 }
 
 bool MainWindow::loadFile() {
+    TRACE_SCOPE("MainWindow::loadFile");
     if (files.empty()) {
         closeFile();
         return false;
     }
-    QImageReader reader(*files.it);
-    reader.setAutoTransform(true);
-    QPixmap pixmap = QPixmap::fromImageReader(&reader);
-    if (pixmap.isNull()) {
+    autoSaver.close();
+    // The cached labels are older than the edits written since
+    if (autoSaver.wait(*files.it+".dat"))
+        imageCache.invalidate(*files.it);
+    ImageCache::Entry entry = imageCache.get(*files.it);
+    imageCache.prefetch(files.list, files.it - files.list.begin());
+    if (entry.image.isNull() && !entry.tiled) {
         closeFile();
-        QMessageBox::information(this, QGuiApplication::applicationDisplayName(), QString("Cannot load %1: %2").arg(QDir::toNativeSeparators(*files.it), reader.errorString()));
+        QMessageBox::information(this, QGuiApplication::applicationDisplayName(), QString("Cannot load %1: %2").arg(QDir::toNativeSeparators(*files.it), entry.error));
         return false;
     }
-    canvas->setPixmap(pixmap);
-    canvas->adjustSize();
+    if (entry.tiled)
+        canvas->setImageFile(&tileDecoder, *files.it);
+    else
+        canvas->setImage(entry.image);
     canvas->setVisible(true);
     dockStatus->show();
     magnifier->setPixmap(QPixmap());
-    undoList.clear();
-    canvas->loadLabels(*files.it+".dat");
+    undoStack.clear();
+    canvas->loadLabelList(entry.labels);
+    autoSaver.open(*files.it+".dat", canvas->labelList());
     return true;
 }
 
 void MainWindow::closeFile() {
+    autoSaver.close();
     canvas->setVisible(false);
-    canvas->setPixmap(QPixmap());
+    canvas->setImage(QImage());
     magnifier->setPixmap(QPixmap());
     updateActions();
 }
@@ -98,15 +164,23 @@ bool MainWindow::eventFilter(QObject* obj, QEvent* event) {
         if (event->type() == QEvent::MouseMove)
             ui->statusBar->clearMessage();
     }
+    // The canvas ignores wheel events so they reach the viewport
+    if (obj == area->viewport() && event->type() == QEvent::Wheel) {
+        auto* wheel = static_cast<QWheelEvent*>(event);
+        if (hasImage() && wheel->modifiers() & Qt::ControlModifier) {
+            zoomCanvas(canvas->zoom()*qPow(2, wheel->angleDelta().y()/480.0), wheel->position().toPoint());
+            return true;
+        }
+    }
     return QMainWindow::eventFilter(obj, event);
 }
 
-void MainWindow::updateStatus(Label* label) {
+void MainWindow::updateStatus(const Label* label) {
     while (auto* item = status->item(0))
         delete item;
     if (label) {
-        status->addItem("Tag: "+label->tag);
-        status->addItem("Color: "+label->brush.color().name().toUpper());
+        status->addItem("Tag: "+label->tag());
+        status->addItem("Color: "+label->brush().color().name().toUpper());
     }
 }
 
@@ -116,33 +190,42 @@ void MainWindow::updateActions() {
     ui->actSaveAs->setEnabled(hasImage());
     ui->actPrev->setEnabled(files.hasPrev());
     ui->actNext->setEnabled(files.hasNext());
+    ui->actNextTagged->setEnabled(datasetIndex.isOpen() && hasImage());
+    ui->actNextUnlabeled->setEnabled(datasetIndex.isOpen() && hasImage());
+    ui->actStatistics->setEnabled(datasetIndex.isOpen());
     ui->actClose->setEnabled(hasImage());
     ui->actCloseAll->setEnabled(hasImage());
     ui->actNew->setEnabled(hasImage());
     ui->actRemoveAll->setEnabled(hasImage());
-    ui->actUndo->setEnabled(undoList.hasPrev());
-    ui->actRedo->setEnabled(undoList.hasNext());
+    for (auto* act: {ui->actZoomIn, ui->actZoomOut, ui->actActualSize, ui->actFitWindow})
+        act->setEnabled(hasImage());
+    ui->actUndo->setEnabled(undoStack.canUndo());
+    ui->actRedo->setEnabled(undoStack.canRedo());
 }
 
 void MainWindow::updateUndoList() {
-    if (!undoList.atEnd())
-        undoList.list.erase(undoList.next(), undoList.list.end());
-    undoList.list << canvas->labelList();
-    undoList.moveToLast();
+    TRACE_SCOPE("MainWindow::updateUndoList");
+    undoStack.record(canvas->labelList());
+    autoSaver.record(canvas->labelList());
     updateActions();
 }
 
 void MainWindow::updateMagnifier(const QPoint& pos) {
+    if (!dockMagnifier->isVisible())
+        return;
+    TRACE_SCOPE("MainWindow::updateMagnifier");
     QSize size = magnifier->size()/2;
     int maxWidth = canvas->size().width();
     int maxHeight = canvas->size().height();
     int w = qMin(maxWidth, size.width());
     int h = qMin(maxHeight, size.height());
     QPoint topLeft(qBound(0, pos.x() - w/2, maxWidth - w), qBound(0, pos.y() - h/2, maxHeight - h));
-    QPixmap pixmap = canvas->grab(QRect(topLeft, QSize(w, h)));
-    QPainter painter(&pixmap);
-    painter.drawPixmap(pos - topLeft, QIcon(":/res/arrow.cur").pixmap(32));
-    magnifier->setPixmap(pixmap.scaled(QSize(w, h)*2));
+    canvas->composite(QRect(topLeft, QSize(w, h)), &magnifierSource);
+    QPainter painter(&magnifierSource);
+    painter.drawPixmap(pos - topLeft, cursorSprite);
+    painter.end();
+    zoomNearest(magnifierSource, &magnifierImage, 2);
+    magnifier->setPixmap(QPixmap::fromImage(magnifierImage));
 }
 
 void MainWindow::on_actOpen_triggered() {
@@ -150,8 +233,11 @@ void MainWindow::on_actOpen_triggered() {
     dlg.setFileMode(QFileDialog::ExistingFiles);
     dlg.setNameFilters({QString("All Supported Files (%1)").arg(imageFilters().join(' ')), "All Files (*)"});
     if (dlg.exec() == QDialog::Accepted) {
+        folderScanner.stop();
+        datasetIndex.close();
         files.list = dlg.selectedFiles();
         files.moveToBegin();
+        imageCache.clear();
         loadFile();
     }
 }
@@ -160,30 +246,44 @@ void MainWindow::on_actOpenFolder_triggered() {
     QFileDialog dlg(this, "Open Folder");
     dlg.setFileMode(QFileDialog::Directory);
     if (dlg.exec() == QDialog::Accepted) {
-        QDir dir(dlg.selectedFiles().first());
         files.clear();
-        for (const QString& fileName: dir.entryList(imageFilters()))
-            files.list << dir.filePath(fileName);
-        files.moveToBegin();
-        loadFile();
+        imageCache.clear();
+        closeFile();
+        // The first image is loaded as soon as it's found
+        datasetIndex.open(dlg.selectedFiles().first());
+        folderScanner.scan(dlg.selectedFiles().first());
     }
 }
 
 void MainWindow::on_actLoad_triggered() {
     QFileDialog dlg(this, "Load Label");
     dlg.setFileMode(QFileDialog::ExistingFile);
-    if (dlg.exec() == QDialog::Accepted)
-        canvas->loadLabels(dlg.selectedFiles().first());
+    if (dlg.exec() == QDialog::Accepted) {
+        QString fileName = dlg.selectedFiles().first();
+        if (!canvas->loadLabels(fileName))
+            QMessageBox::information(this, QGuiApplication::applicationDisplayName(), QString("Cannot load %1").arg(QDir::toNativeSeparators(fileName)));
+    }
 }
 
 void MainWindow::on_actSave_triggered() {
-    canvas->saveLabels(*files.it+".dat");
+    // Errors are reported when the write finishes
+    autoSaver.save(canvas->labelList());
 }
 
 void MainWindow::on_actSaveAs_triggered() {
     QFileDialog dlg(this, "Save Label As");
-    if (dlg.exec() == QDialog::Accepted)
-        canvas->saveLabels(dlg.selectedFiles().first());
+    QStringList filters{"Label Files (*.dat)", "Legacy Label Files (*.dat)"};
+    dlg.setNameFilters(filters);
+    if (dlg.exec() == QDialog::Accepted) {
+        QString fileName = dlg.selectedFiles().first();
+        int format = dlg.selectedNameFilter() == filters.last() ? LabelFile::Legacy : LabelFile::Compact;
+        // Queued after the auto saved writes so that they can't overwrite it
+        autoSaver.saveAs(fileName, canvas->labelList(), format);
+    }
+}
+
+void MainWindow::on_actAutoSave_toggled(bool checked) {
+    autoSaver.setEnabled(checked);
 }
 
 void MainWindow::on_actPrev_triggered() {
@@ -196,6 +296,40 @@ void MainWindow::on_actNext_triggered() {
     loadFile();
 }
 
+void MainWindow::on_actNextTagged_triggered() {
+    QDialog dlg(this);
+    auto* edit = initInputDialog(&dlg, "Next Image with Tag", "Tag Name:");
+    if (dlg.exec() != QDialog::Accepted)
+        return;
+    int index = datasetIndex.nextWithTag(files.list, files.it - files.list.begin(), edit->text());
+    if (index < 0) {
+        indexPending = !datasetIndex.isReady();
+        ui->statusBar->showMessage(indexPending ? QString("No indexed image with tag %1 yet").arg(edit->text()) : QString("No image with tag %1").arg(edit->text()));
+        return;
+    }
+    files.it = files.list.begin() + index;
+    loadFile();
+}
+
+void MainWindow::on_actNextUnlabeled_triggered() {
+    int index = datasetIndex.nextUnlabeled(files.list, files.it - files.list.begin());
+    if (index < 0) {
+        indexPending = !datasetIndex.isReady();
+        ui->statusBar->showMessage(indexPending ? "No indexed unlabeled image yet" : "No unlabeled image");
+        return;
+    }
+    files.it = files.list.begin() + index;
+    loadFile();
+}
+
+void MainWindow::on_actStatistics_triggered() {
+    QString text = QString::asprintf("Images: %d\nIndexed: %d\nLabeled: %d\n", files.list.size(), datasetIndex.count(), datasetIndex.labeledCount());
+    QMap<QString, int> counts = datasetIndex.tagCounts();
+    for (auto it = counts.begin(); it != counts.end(); ++it)
+        text += QString("\n%1: %2").arg(it.key()).arg(it.value());
+    QMessageBox::information(this, "Dataset Statistics", text);
+}
+
 void MainWindow::on_actClose_triggered() {
     files.it = files.list.erase(files.it);
     if (files.empty())
@@ -208,7 +342,10 @@ void MainWindow::on_actClose_triggered() {
 }
 
 void MainWindow::on_actCloseAll_triggered() {
+    folderScanner.stop();
+    datasetIndex.close();
     files.clear();
+    imageCache.clear();
     closeFile();
     dockStatus->close();
     dockMagnifier->close();
@@ -216,14 +353,24 @@ void MainWindow::on_actCloseAll_triggered() {
 
 void MainWindow::on_actNew_triggered() {
     LabelDialog dlg(this);
-    if (dlg.exec() == QDialog::Accepted)
-        canvas->newLabel({dlg.text(), dlg.shape, dlg.hasBorder() ? Label::getPen(dlg.color) : QPen(Qt::NoPen), QBrush(dlg.color), QPainterPath()});
+    if (dlg.exec() != QDialog::Accepted)
+        return;
+    Label label{dlg.text(), dlg.shape, dlg.hasBorder() ? Label::getPen(dlg.color) : QPen(Qt::NoPen), QBrush(dlg.color), QPainterPath()};
+    if (!label.style.isValid()) {
+        QMessageBox::information(this, QGuiApplication::applicationDisplayName(), "Too many label styles, reuse the tag and color of an existing label");
+        return;
+    }
+    canvas->newLabel(label);
 }
 
 void MainWindow::on_actRemove_triggered() {
     canvas->removeSelectedLabel();
 }
 
+void MainWindow::on_actConvertToMask_triggered() {
+    canvas->convertSelectedLabel();
+}
+
 void MainWindow::on_actRemoveAll_triggered() {
     QDialog dlg(this);
     auto* edit = initInputDialog(&dlg, "Remove by Tag", "Tag Name:");
@@ -232,11 +379,13 @@ void MainWindow::on_actRemoveAll_triggered() {
 }
 
 void MainWindow::on_actUndo_triggered(){
-    canvas->setLabelList(*--undoList.it);
+    canvas->setLabelList(undoStack.undo());
+    autoSaver.record(canvas->labelList());
 }
 
 void MainWindow::on_actRedo_triggered(){
-    canvas->setLabelList(*++undoList.it);
+    canvas->setLabelList(undoStack.redo());
+    autoSaver.record(canvas->labelList());
 }
 
 void MainWindow::on_actSwitch_triggered() {
@@ -261,3 +410,54 @@ QLineEdit* MainWindow::initInputDialog(QDialog* dlg, const QString& title, const
     connect(btnBox, &QDialogButtonBox::rejected, dlg, &QDialog::reject);
     return edit;
 }
+
+void MainWindow::on_actZoomIn_triggered() {
+    zoomCanvas(canvas->zoom()*2, area->viewport()->rect().center());
+}
+
+void MainWindow::on_actZoomOut_triggered() {
+    zoomCanvas(canvas->zoom()/2, area->viewport()->rect().center());
+}
+
+void MainWindow::on_actActualSize_triggered() {
+    zoomCanvas(1, area->viewport()->rect().center());
+}
+
+void MainWindow::on_actFitWindow_triggered() {
+    QSizeF size = QSizeF(canvas->size())/canvas->zoom();
+    QSize view = area->viewport()->size();
+    zoomCanvas(qMin(view.width()/size.width(), view.height()/size.height()), area->viewport()->rect().center());
+}
+
+void MainWindow::zoomCanvas(qreal zoom, const QPoint& anchor) {
+    zoom = qBound(1.0/64, zoom, 32.0);
+    QPointF pos = canvas->mapToImage(canvas->mapFrom(area->viewport(), anchor));
+    canvas->setZoom(zoom);
+    // The scroll area has moved the canvas after its resize
+    QPoint delta = canvas->mapTo(area->viewport(), canvas->mapFromImage(pos).toPoint()) - anchor;
+    area->horizontalScrollBar()->setValue(area->horizontalScrollBar()->value() + delta.x());
+    area->verticalScrollBar()->setValue(area->verticalScrollBar()->value() + delta.y());
+}
+
+#ifdef LABELING_TRACE
+void MainWindow::addTraceActions() {
+    auto* overlay = new TraceOverlay(area);
+    overlay->move(8, 8);
+    overlay->hide();
+    ui->menuView->addSeparator();
+    QAction* actOverlay = ui->menuView->addAction("Frame Time Overlay");
+    actOverlay->setCheckable(true);
+    connect(actOverlay, &QAction::toggled, [=] (bool checked) {
+        overlay->setVisible(checked);
+        overlay->raise();
+    });
+    QAction* actExport = ui->menuView->addAction("Export Trace...");
+    connect(actExport, &QAction::triggered, [=] () {
+        QString fileName = QFileDialog::getSaveFileName(this, "Export Trace", "trace.json", "Chrome Trace Files (*.json)");
+        if (fileName.isEmpty())
+            return;
+        if (!Trace::instance()->writeChromeTrace(fileName))
+            QMessageBox::information(this, QGuiApplication::applicationDisplayName(), QString("Cannot save %1").arg(QDir::toNativeSeparators(fileName)));
+    });
+}
+#endif
@@ -5,6 +5,12 @@
 #include "windowfwd.h"
 #include "renderarea.h"
 #include "listex.h"
+#include "undostack.h"
+#include "imagecache.h"
+#include "tiledecoder.h"
+#include "autosaver.h"
+#include "folderscanner.h"
+#include "datasetindex.h"
 
 namespace Ui {
 class MainWindow;
@@ -36,7 +42,7 @@ private slots:
     void updateActions();
 
     void updateUndoList();
-    void updateStatus(Label* label);
+    void updateStatus(const Label* label);
     void updateMagnifier(const QPoint& pos);
 
     void on_actOpen_triggered();
@@ -44,22 +50,39 @@ private slots:
     void on_actLoad_triggered();
     void on_actSave_triggered();
     void on_actSaveAs_triggered();
+    void on_actAutoSave_toggled(bool checked);
     void on_actPrev_triggered();
     void on_actNext_triggered();
+    void on_actNextTagged_triggered();
+    void on_actNextUnlabeled_triggered();
+    void on_actStatistics_triggered();
     void on_actClose_triggered();
     void on_actCloseAll_triggered();
     void on_actNew_triggered();
     void on_actRemove_triggered();
     void on_actRemoveAll_triggered();
+    void on_actConvertToMask_triggered();
     void on_actUndo_triggered();
     void on_actRedo_triggered();
     void on_actSwitch_triggered();
+    void on_actZoomIn_triggered();
+    void on_actZoomOut_triggered();
+    void on_actActualSize_triggered();
+    void on_actFitWindow_triggered();
 
 private:
     // The layout of the standard QInputDialog looks awful because the label is above the edit.
     // It seems there's way to put the label on the left of the edit but to set all widgets manually.
     static QLineEdit* initInputDialog(QDialog* dlg, const QString& title, const QString& labelText);
 
+    // Keep the image point under the anchor of the viewport in place
+    void zoomCanvas(qreal zoom, const QPoint& anchor);
+
+#ifdef LABELING_TRACE
+    // Show the frame time overlay and export the trace
+    void addTraceActions();
+#endif
+
 private:
     SubWindow* subWindow;
     Ui::MainWindow* ui;
@@ -75,11 +98,33 @@ private:
     QDockWidget* dockMagnifier;
     QLabel* magnifier;
 
+    // Buffers reused by each update of the magnifier
+    QPixmap cursorSprite;
+    QImage magnifierSource;
+    QImage magnifierImage;
+
     ListEx<QString> files;
 
-    // Save the whole label list whenever it changes
-    // It's efficient because of the implicit sharing
-    ListEx<QList<Label>> undoList;
+    // Files of an opened folder arrive in batches
+    FolderScanner folderScanner;
+
+    // Tags of every image in the opened folder
+    DatasetIndex datasetIndex;
+
+    // Whether the status bar says that images are not indexed yet
+    bool indexPending = false;
+
+    // Neighbours of the current file are decoded in the background
+    ImageCache imageCache;
+
+    // Large images are decoded by tiles in view
+    TileDecoder tileDecoder;
+
+    // Only the labels replaced by each change are saved
+    UndoStack undoStack;
+
+    // Destroyed first so that pending edits are written before the rest is gone
+    AutoSaver autoSaver;
 };
 
 #endif // MAINWINDOW_H
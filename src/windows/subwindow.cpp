@@ -2,7 +2,9 @@
 #include "ui_subwindow.h"
 #include "mainwindow.h"
 #include "cuboiddialog.h"
+#include "labelfile.h"
 #include "util.h"
+#include "trace.h"
 
 SubWindow::SubWindow(MainWindow* window, QWidget* parent) :
     QMainWindow(parent),
@@ -11,9 +13,16 @@ SubWindow::SubWindow(MainWindow* window, QWidget* parent) :
     imgTop(new RenderArea),
     imgLeft(new RenderArea),
     imgFront(new RenderArea),
-    grpBox(new QGroupBox)
+    grpBox(new QGroupBox),
+    spnLevel(new QSpinBox),
+    spnWidth(new QSpinBox),
+    refreshTimer(new QTimer(this)),
+    slices(&volume)
 {
     ui->setupUi(this);
+    refreshTimer->setSingleShot(true);
+    refreshTimer->setInterval(1000/60);
+    connect(refreshTimer, &QTimer::timeout, this, &SubWindow::refresh);
     auto* area1 = new QScrollArea(this);
     auto* area2 = new QScrollArea(this);
     auto* area3 = new QScrollArea(this);
@@ -33,6 +42,16 @@ SubWindow::SubWindow(MainWindow* window, QWidget* parent) :
     grpBox->setLayout(hLayout);
     setCentralWidget(grpBox);
 
+    auto* windowBar = addToolBar("Window");
+    windowBar->addWidget(new QLabel("Level "));
+    windowBar->addWidget(spnLevel);
+    windowBar->addWidget(new QLabel(" Width "));
+    windowBar->addWidget(spnWidth);
+    for (auto* spn: {spnLevel, spnWidth}) {
+        spn->setEnabled(false);
+        connect(spn, QOverload<int>::of(&QSpinBox::valueChanged), this, &SubWindow::updateWindow);
+    }
+
     for (auto* img: images()) {
         img->setVisible(false);
         connect(img, &RenderArea::mousePressed, this, &SubWindow::toggleActiveImage);
@@ -41,21 +60,21 @@ SubWindow::SubWindow(MainWindow* window, QWidget* parent) :
         if (activeImg == imgTop) {
             cursor.x = pos.x();
             cursor.y = pos.y();
-            refresh();
+            scheduleRefresh();
         }
     });
     connect(imgLeft, &RenderArea::mouseMoved, [&] (const QPoint& pos) {
         if (activeImg == imgLeft) {
             cursor.y = pos.x();
             cursor.z = pos.y();
-            refresh();
+            scheduleRefresh();
         }
     });
     connect(imgFront, &RenderArea::mouseMoved, [&] (const QPoint& pos) {
         if (activeImg == imgFront) {
             cursor.x = pos.x();
             cursor.z = pos.y();
-            refresh();
+            scheduleRefresh();
         }
     });
 }
@@ -65,54 +84,77 @@ SubWindow::~SubWindow() {
 }
 
 bool SubWindow::load(const QString& dirName) {
-    QVector<QImage> imgs;
-    QDir dir(dirName);
-    for (const QString& fileName: dir.entryList(imageFilters())) {
-        QString path = dir.filePath(fileName);
-        QImageReader reader(path);
-        reader.setAutoTransform(true);
-        QImage img = reader.read();
-        if (img.isNull()) {
-            QMessageBox::information(this, QGuiApplication::applicationDisplayName(), QString("Cannot load %1: %2").arg(QDir::toNativeSeparators(path), reader.errorString()));
-            return false;
-        }
-        imgs << img;
-    }
-    if (imgs.empty())
+    QProgressDialog dlg("Loading slices...", "Cancel", 0, 0, this);
+    dlg.setWindowModality(Qt::WindowModal);
+    QFutureWatcher<void> watcher;
+    connect(&watcher, &QFutureWatcherBase::progressRangeChanged, &dlg, &QProgressDialog::setRange);
+    connect(&watcher, &QFutureWatcherBase::progressValueChanged, &dlg, &QProgressDialog::setValue);
+    connect(&dlg, &QProgressDialog::canceled, &watcher, &QFutureWatcherBase::cancel);
+
+    // Keep the window responsive while slices are decoded
+    auto wait = [&] (QFuture<void> future) {
+        QEventLoop loop;
+        connect(&watcher, &QFutureWatcherBase::finished, &loop, &QEventLoop::quit);
+        watcher.setFuture(future);
+        if (!watcher.isFinished())
+            loop.exec();
+    };
+
+    QString error;
+    // Workers must not read the volume while it's replaced
+    slices.clear();
+    if (!volume.load(dirName, &error, wait)) {
+        if (!error.isEmpty())
+            QMessageBox::information(this, QGuiApplication::applicationDisplayName(), error);
         return false;
-    for (const QImage& img: imgs)
-        if (img.size() != imgs.first().size())
-            return false;
+    }
+    imgSize = {volume.height(), volume.width(), volume.depth()};
+    shown = {-1, -1, -1};
 
-    imgSize = {imgs.first().height(), imgs.first().width(), imgs.size()};
-    imgData.clear();
-    for (QImage& img: imgs) {
-        if (!QSet<QImage::Format>{QImage::Format_RGB32, QImage::Format_ARGB32}.contains(img.format()))
-            img = img.convertToFormat(QImage::Format_ARGB32);
-        imgData << img;
+    int range = volume.format() == Volume::Gray16 ? 0xFFFF : 0xFF;
+    for (auto* spn: {spnLevel, spnWidth}) {
+        QSignalBlocker blocker(spn);
+        spn->setRange(spn == spnWidth ? 1 : 0, range + 1);
+        spn->setEnabled(volume.format() != Volume::Rgb32);
     }
+    QSignalBlocker levelBlocker(spnLevel);
+    QSignalBlocker widthBlocker(spnWidth);
+    spnLevel->setValue(volume.windowLevel());
+    spnWidth->setValue(volume.windowWidth());
     return true;
 }
 
 void SubWindow::refresh() {
+    TRACE_FRAME("SubWindow::refresh");
+    refreshTimer->stop();
     ui->statusBar->showMessage(QString::asprintf("Cursor: (%d, %d, %d)", cursor.x, cursor.y, cursor.z));
-    setTop(cursor.z);
-    setLeft(cursor.x);
-    setFront(cursor.y);
-    QList<Label> top;
-    QList<Label> left;
-    QList<Label> front;
-    for (const auto& label: labels) {
-        if (label.z1 <= cursor.z && cursor.z <= label.z2)
-            top << label.top();
-        if (label.x1 <= cursor.x && cursor.x <= label.x2)
-            left << label.left();
-        if (label.y1 <= cursor.y && cursor.y <= label.y2)
-            front << label.front();
-    }
-    imgTop->setLabelList(top);
-    imgLeft->setLabelList(left);
-    imgFront->setLabelList(front);
+    if (cursor.z != shown.z)
+        setTop(cursor.z);
+    if (cursor.x != shown.x)
+        setLeft(cursor.x);
+    if (cursor.y != shown.y)
+        setFront(cursor.y);
+    shown = {cursor.x, cursor.y, cursor.z};
+    auto project = [&] (const QList<Label>& projections, int axis) {
+        QList<Label> result;
+        for (int i: index.visible(axis))
+            result << projections[i];
+        return result;
+    };
+    if (index.moveTo(CuboidIndex::Z, cursor.z))
+        imgTop->setLabelList(project(tops, CuboidIndex::Z));
+    if (index.moveTo(CuboidIndex::X, cursor.x))
+        imgLeft->setLabelList(project(lefts, CuboidIndex::X));
+    if (index.moveTo(CuboidIndex::Y, cursor.y))
+        imgFront->setLabelList(project(fronts, CuboidIndex::Y));
+}
+
+void SubWindow::scheduleRefresh() {
+    // Mouse moves are handled within the input of the image they are over,
+    // so the next refresh counts its latency from there
+    TRACE_UPDATE();
+    if (!refreshTimer->isActive())
+        refreshTimer->start();
 }
 
 void SubWindow::toggleActiveImage(RenderArea* img) {
@@ -129,6 +171,18 @@ void SubWindow::updateActions(bool open) {
     ui->actRemove->setEnabled(open);
 }
 
+void SubWindow::updateWindow() {
+    // Typed or stepped in the spin boxes
+    TRACE_INPUT();
+    TRACE_SCOPE("SubWindow::updateWindow");
+    slices.clear();
+    volume.setWindow(spnLevel->value(), spnWidth->value());
+    if (volume.isNull())
+        return;
+    shown = {-1, -1, -1};
+    scheduleRefresh();
+}
+
 void SubWindow::on_actSwitch_triggered() {
     hide();
     mainWindow->show();
@@ -142,6 +196,7 @@ void SubWindow::on_actOpen_triggered() {
             activeImg = nullptr;
             cursor = {0, 0, 0};
             labels.clear();
+            updateIndex();
             refresh();
             for (auto* img: images())
                 img->setVisible(true);
@@ -153,24 +208,23 @@ void SubWindow::on_actLoad_triggered() {
     QFileDialog dlg(this, "Load Label");
     dlg.setFileMode(QFileDialog::ExistingFile);
     if (dlg.exec() == QDialog::Accepted) {
-        labels.clear();
-        QFile file(dlg.selectedFiles().first());
-        if (file.open(QIODevice::ReadOnly)) {
-            QDataStream istream(&file);
-            istream >> labels;
-        }
+        QString fileName = dlg.selectedFiles().first();
+        if (!LabelFile::read(fileName, &labels))
+            QMessageBox::information(this, QGuiApplication::applicationDisplayName(), QString("Cannot load %1").arg(QDir::toNativeSeparators(fileName)));
+        updateIndex();
         refresh();
     }
 }
 
 void SubWindow::on_actSave_triggered() {
     QFileDialog dlg(this, "Save Label As");
+    QStringList filters{"Label Files (*.dat)", "Legacy Label Files (*.dat)"};
+    dlg.setNameFilters(filters);
     if (dlg.exec() == QDialog::Accepted) {
-        QFile file(dlg.selectedFiles().first());
-        if (file.open(QIODevice::WriteOnly)) {
-            QDataStream ostream(&file);
-            ostream << labels;
-        }
+        QString fileName = dlg.selectedFiles().first();
+        int format = dlg.selectedNameFilter() == filters.last() ? LabelFile::Legacy : LabelFile::Compact;
+        if (!LabelFile::write(fileName, labels, format))
+            QMessageBox::information(this, QGuiApplication::applicationDisplayName(), QString("Cannot save %1").arg(QDir::toNativeSeparators(fileName)));
     }
 }
 
@@ -184,6 +238,7 @@ void SubWindow::on_actNew_triggered() {
     CuboidDialog dlg(imgSize.h, imgSize.w, imgSize.d, this);
     if (dlg.exec() == QDialog::Accepted) {
         labels << CuboidLabel{dlg.x1(), dlg.y1(), dlg.z1(), dlg.x2(), dlg.y2(), dlg.z2(), dlg.text(), dlg.hasBorder() ? Label::getPen(dlg.color) : QPen(Qt::NoPen), QBrush(dlg.color)};
+        updateIndex();
         refresh();
     }
 }
@@ -198,64 +253,53 @@ void SubWindow::on_actRemove_triggered() {
         bool changed = false;
         QList<CuboidLabel> rested;
         for (const auto& label: labels) {
-            if (label.tag != tag)
+            if (label.tag() != tag)
                 rested << label;
             else
                 changed = true;
         }
         if (changed) {
             labels = rested;
+            updateIndex();
             for (auto* img: images())
                 img->remove(tag);
         }
     }
 }
 
-QImage SubWindow::getTop(int k) {
-    QImage img(imgSize.w, imgSize.h, QImage::Format_ARGB32);
-    for (int i = 0; i < img.height(); ++i) {
-        QRgb* line = reinterpret_cast<QRgb*>(img.scanLine(i));
-        for (int j = 0; j < img.width(); ++j)
-            line[j] = reinterpret_cast<const QRgb*>(imgData[k].constBits())[i*imgSize.w + j];
-    }
-    return img;
-}
-
-QImage SubWindow::getLeft(int j) {
-    QImage img(imgSize.h, imgSize.d, QImage::Format_ARGB32);
-    for (int k = 0; k < img.height(); ++k) {
-        QRgb* line = reinterpret_cast<QRgb*>(img.scanLine(k));
-        for (int i = 0; i < img.width(); ++i)
-            line[i] = reinterpret_cast<const QRgb*>(imgData[k].constBits())[i*imgSize.w + j];
-    }
-    return img;
-}
-
-QImage SubWindow::getFront(int i) {
-    QImage img(imgSize.w, imgSize.d, QImage::Format_ARGB32);
-    for (int k = 0; k < img.height(); ++k) {
-        QRgb* line = reinterpret_cast<QRgb*>(img.scanLine(k));
-        for (int j = 0; j < img.width(); ++j)
-            line[j] = reinterpret_cast<const QRgb*>(imgData[k].constBits())[i*imgSize.w + j];
-    }
-    return img;
-}
-
 void SubWindow::setTop(int k) {
-    imgTop->setPixmap(QPixmap::fromImage(getTop(k)));
-    imgTop->adjustSize();
+    setSlice(imgTop, slices.get(SliceCache::Top, k));
+    slices.prefetch(SliceCache::Top, k);
 }
 
 void SubWindow::setLeft(int j) {
-    imgLeft->setPixmap(QPixmap::fromImage(getLeft(j)));
-    imgLeft->adjustSize();
+    setSlice(imgLeft, slices.get(SliceCache::Left, j));
+    slices.prefetch(SliceCache::Left, j);
 }
 
 void SubWindow::setFront(int i) {
-    imgFront->setPixmap(QPixmap::fromImage(getFront(i)));
-    imgFront->adjustSize();
+    setSlice(imgFront, slices.get(SliceCache::Front, i));
+    slices.prefetch(SliceCache::Front, i);
+}
+
+void SubWindow::setSlice(RenderArea* img, const QPixmap& slice) {
+    img->setPixmap(slice);
+    if (img->size() != slice.size())
+        img->adjustSize();
 }
 
 QList<RenderArea*> SubWindow::images() {
     return {imgTop, imgLeft, imgFront};
 }
+
+void SubWindow::updateIndex() {
+    index.build(labels);
+    tops.clear();
+    lefts.clear();
+    fronts.clear();
+    for (const auto& label: labels) {
+        tops << label.top();
+        lefts << label.left();
+        fronts << label.front();
+    }
+}
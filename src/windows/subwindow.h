@@ -5,6 +5,9 @@
 #include "windowfwd.h"
 #include "renderarea.h"
 #include "cuboidlabel.h"
+#include "volume.h"
+#include "cuboidindex.h"
+#include "slicecache.h"
 
 namespace Ui {
 class SubWindow;
@@ -23,11 +26,18 @@ public:
 
 private slots:
     // Update images in each views according to the current cursor
+    // Only views whose slice changes are updated
     void refresh();
 
+    // Refresh at most once per frame while the cursor moves
+    void scheduleRefresh();
+
     void toggleActiveImage(RenderArea* img);
     void updateActions(bool open);
 
+    // Only re-maps voxels to colors without decoding anything
+    void updateWindow();
+
     void on_actSwitch_triggered();
     void on_actOpen_triggered();
     void on_actLoad_triggered();
@@ -37,16 +47,17 @@ private slots:
     void on_actRemove_triggered();
 
 private:
-    QImage getTop(int k);
-    QImage getLeft(int j);
-    QImage getFront(int i);
     void setTop(int k);
     void setLeft(int j);
     void setFront(int i);
+    void setSlice(RenderArea* img, const QPixmap& slice);
 
     // For convenience to set all views
     QList<RenderArea*> images();
 
+    // Must be called whenever the labels change
+    void updateIndex();
+
 private:
     MainWindow* mainWindow;
     Ui::SubWindow* ui;
@@ -56,14 +67,33 @@ private:
     RenderArea* imgFront;
     QGroupBox* grpBox;
 
+    // Window of gray values, disabled for RGB volumes
+    QSpinBox* spnLevel;
+    QSpinBox* spnWidth;
+
     RenderArea* activeImg = nullptr;
     struct { int x, y, z; } cursor{0, 0, 0};
     struct { int h, w, d; } imgSize{0, 0, 0};
 
-    // Store images directly to avoid a deep copy
-    QVector<QImage> imgData;
+    // Cursor of the slices currently shown, -1 if none
+    struct { int x, y, z; } shown{-1, -1, -1};
+    QTimer* refreshTimer;
+
+    // Voxels are mapped from a cache file instead of being held in memory
+    Volume volume;
+
+    // Slices shown recently or near the cursor
+    SliceCache slices;
 
     QList<CuboidLabel> labels;
+
+    // Only views whose set of visible cuboids changes get new labels
+    CuboidIndex index;
+
+    // Projections of each cuboid are built once
+    QList<Label> tops;
+    QList<Label> lefts;
+    QList<Label> fronts;
 };
 
 #endif // SUBWINDOW_H